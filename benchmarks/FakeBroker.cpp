@@ -0,0 +1,924 @@
+#include <algorithm>
+#include <cstdio>
+#include <set>
+#include <boost/asio/write.hpp>
+#include "../src/AmqpLoopbackTransport.hpp"
+#include "FakeBroker.hpp"
+
+using namespace amqp;
+using namespace amqp::bench;
+
+namespace {
+
+///
+/// Типы кадров AMQP 0-9-1.
+///
+enum FrameType: uint8_t
+{
+  eMethodFrame = 1,
+  eHeaderFrame = 2,
+  eBodyFrame = 3,
+  eHeartbeatFrame = 8
+};
+
+const char FrameEnd = '\xCE';
+const std::size_t FrameOverhead = 8; // header and end octet
+const uint32_t FrameMax = 131072; // proposed to clients
+
+///
+/// Идентификатор метода AMQP: класс и метод.
+///
+constexpr uint32_t Method(uint16_t cls, uint16_t method)
+{
+  return (uint32_t(cls) << 16) | method;
+}
+
+///
+/// Чтение полей кадра в сетевом порядке байтов.
+///
+/// Брокер доверяет клиенту: выход за границы кадра дает нули, а не ошибку.
+///
+class Reader
+{
+  public:
+    Reader(const char* data, std::size_t size):
+      m_p(reinterpret_cast<const unsigned char*>(data)),
+      m_end(m_p + size)
+    {
+    }
+
+    uint8_t u8() { return (m_p < m_end) ? *m_p++ : 0; }
+    uint16_t u16()
+    {
+      uint16_t high = u8();
+      return (high << 8) | u8();
+    }
+    uint32_t u32()
+    {
+      uint32_t high = u16();
+      return (high << 16) | u16();
+    }
+    uint64_t u64()
+    {
+      uint64_t high = u32();
+      return (high << 32) | u32();
+    }
+    std::string shortstr() { return take(u8()); }
+    std::string longstr() { return take(u32()); }
+    void table() { skip(u32()); }
+
+  private:
+    std::string take(std::size_t size)
+    {
+      size = std::min<std::size_t>(size, m_end - m_p);
+      std::string s(reinterpret_cast<const char*>(m_p), size);
+      m_p += size;
+      return s;
+    }
+    void skip(std::size_t size)
+    {
+      m_p += std::min<std::size_t>(size, m_end - m_p);
+    }
+
+    const unsigned char* m_p;
+    const unsigned char* m_end;
+};
+
+inline void Put8(std::string& out, uint8_t value)
+{
+  out.push_back(char(value));
+}
+
+inline void Put16(std::string& out, uint16_t value)
+{
+  Put8(out, value >> 8);
+  Put8(out, value);
+}
+
+inline void Put32(std::string& out, uint32_t value)
+{
+  Put16(out, value >> 16);
+  Put16(out, value);
+}
+
+inline void Put64(std::string& out, uint64_t value)
+{
+  Put32(out, value >> 32);
+  Put32(out, value);
+}
+
+inline void PutShort(std::string& out, const std::string& value)
+{
+  std::size_t size = std::min<std::size_t>(value.size(), 255);
+  Put8(out, size);
+  out.append(value, 0, size);
+}
+
+inline void PutLong(std::string& out, const std::string& value)
+{
+  Put32(out, value.size());
+  out.append(value);
+}
+
+///
+/// Начать кадр.
+///
+/// @return Позиция поля размера кадра для EndFrame().
+///
+std::size_t BeginFrame(std::string& out, uint8_t type, uint16_t channel)
+{
+  Put8(out, type);
+  Put16(out, channel);
+  std::size_t at = out.size();
+  Put32(out, 0);
+  return at;
+}
+
+void EndFrame(std::string& out, std::size_t at)
+{
+  uint32_t size = out.size() - at - 4;
+  for (int i = 3; i >= 0; --i, size >>= 8) out[at + i] = char(size & 0xFF);
+  out.push_back(FrameEnd);
+}
+
+std::size_t BeginMethod(std::string& out, uint16_t channel, uint32_t method)
+{
+  std::size_t at = BeginFrame(out, eMethodFrame, channel);
+  Put32(out, method);
+  return at;
+}
+
+///
+/// Содержимое кадра заголовка сообщения без свойств.
+///
+std::string ContentHeader(uint64_t bodySize)
+{
+  std::string header;
+  Put16(header, 60); // basic
+  Put16(header, 0); // weight
+  Put64(header, bodySize);
+  Put16(header, 0); // property flags
+  return header;
+}
+
+} // namespace
+
+///
+/// Соединение клиента с имитатором брокера.
+///
+/// Разбирает кадры клиента и формирует ответы. Все методы выполняются в
+/// контексте strand соединения: для LoopbackTransport -- strand коннектора,
+/// для сокета -- собственный strand.
+///
+class FakeBroker::Session: public std::enable_shared_from_this<Session>
+{
+  public:
+    Session(FakeBroker& broker, const boost::asio::io_service::strand& strand):
+      m_strand(strand),
+      m_broker(broker),
+      m_frameMax(FrameMax),
+      m_greeted(false),
+      m_consumerSeq(0)
+    {
+    }
+
+    ///
+    /// Передавать ответы через транспорт в памяти процесса.
+    ///
+    void attach(const std::shared_ptr<LoopbackTransport>& transport)
+    {
+      m_loopback = transport;
+    }
+
+    ///
+    /// Начать обмен через сокет.
+    ///
+    void open()
+    {
+      m_readBuf.resize(65536);
+      read();
+    }
+
+    ///
+    /// Принять данные от клиента.
+    ///
+    void feed(const char* data, std::size_t size)
+    {
+      if (m_in.empty())
+      {
+        std::size_t used = parse(data, size);
+        m_in.assign(data + used, size - used);
+      }
+      else
+      {
+        m_in.append(data, size);
+        m_in.erase(0, parse(m_in.data(), m_in.size()));
+      }
+      confirm();
+      flush();
+    }
+
+    ///
+    /// Отправить клиенту сообщения подписчика.
+    ///
+    void deliver(uint16_t channel, const std::string& tag,
+                 const std::string& header, const std::string& body,
+                 const std::string& exchange, const std::string& key,
+                 std::size_t count)
+    {
+      auto i = m_channels.find(channel);
+      if ((i == m_channels.end()) || i->second.closing) return;
+      for (std::size_t n = 0; n < count; ++n)
+      {
+        std::size_t at = BeginMethod(m_out, channel, Method(60, 60));
+        PutShort(m_out, tag);
+        Put64(m_out, ++i->second.deliveryTag);
+        Put8(m_out, 0); // redelivered
+        PutShort(m_out, exchange);
+        PutShort(m_out, key);
+        EndFrame(m_out, at);
+        content(channel, header, body);
+      }
+      m_broker.m_delivered += count;
+      flush();
+    }
+
+    boost::asio::io_service::strand m_strand; ///< Strand соединения.
+    std::unique_ptr<boost::asio::local::stream_protocol::socket>
+      m_socket; ///< Сокет, если клиент подключен через сокет.
+
+  private:
+    ///
+    /// Состояние канала.
+    ///
+    struct Channel
+    {
+      bool closing = false; ///< Брокер закрывает канал.
+      bool confirm = false; ///< Включено подтверждение публикаций.
+      uint64_t publishSeq = 0; ///< Номер последней публикации.
+      uint64_t confirmed = 0; ///< Номер последней подтвержденной публикации.
+      uint64_t deliveryTag = 0; ///< Тэг последней доставки.
+      uint64_t ackedUpTo = 0; ///< Наибольший тэг в подтверждениях клиента.
+      bool publishing = false; ///< Ожидается содержимое публикации.
+      bool mandatory = false; ///< Флаг mandatory публикации.
+      std::string exchange, ///< Точка обмена публикации.
+                  key; ///< Ключ маршрутизации публикации.
+      std::shared_ptr<std::string> header, ///< Заголовок публикации.
+                                   body; ///< Тело публикации.
+      uint64_t bodySize = 0; ///< Ожидаемый размер тела.
+    };
+
+    ///
+    /// Разобрать принятые данные.
+    ///
+    /// @return Число разобранных байтов.
+    ///
+    std::size_t parse(const char* data, std::size_t size)
+    {
+      std::size_t used = 0;
+      if (!m_greeted)
+      {
+        if (size < 8) return 0; // "AMQP" 0 0 9 1
+        m_greeted = true;
+        used = 8;
+        std::size_t at = BeginMethod(m_out, 0, Method(10, 10));
+        Put8(m_out, 0);
+        Put8(m_out, 9);
+        Put32(m_out, 0); // server properties
+        PutLong(m_out, "PLAIN");
+        PutLong(m_out, "en_US");
+        EndFrame(m_out, at);
+      }
+      while (size - used >= FrameOverhead - 1)
+      {
+        Reader in(data + used, FrameOverhead - 1);
+        uint8_t type = in.u8();
+        uint16_t channel = in.u16();
+        uint32_t length = in.u32();
+        if (size - used < FrameOverhead + length) break;
+        frame(type, channel, data + used + FrameOverhead - 1, length);
+        used += FrameOverhead + length;
+      }
+      return used;
+    }
+
+    void frame(uint8_t type, uint16_t channel, const char* payload,
+               std::size_t size)
+    {
+      if (type == eMethodFrame)
+      {
+        Reader in(payload, size);
+        uint32_t id = in.u32();
+        method(channel, id, in);
+        return;
+      }
+      if ((type != eHeaderFrame) && (type != eBodyFrame)) return;
+      auto i = m_channels.find(channel);
+      if ((i == m_channels.end()) || !i->second.publishing) return;
+      Channel& ch = i->second;
+      if (type == eHeaderFrame)
+      {
+        ch.header = std::make_shared<std::string>(payload, size);
+        Reader in(payload, size);
+        in.u32(); // class and weight
+        ch.bodySize = in.u64();
+        ch.body = std::make_shared<std::string>();
+        ch.body->reserve(ch.bodySize);
+      }
+        else ch.body->append(payload, size);
+      if (ch.body->size() >= ch.bodySize) publish(channel, ch);
+    }
+
+    void method(uint16_t channel, uint32_t id, Reader& in)
+    {
+      if (channel == 0)
+      {
+        connectionMethod(id, in);
+        return;
+      }
+      if (id == Method(20, 10))
+      {
+        m_channels[channel] = Channel();
+        reply(channel, Method(20, 11), [](std::string& out) {
+          PutLong(out, std::string());
+        });
+        return;
+      }
+      auto i = m_channels.find(channel);
+      if (i == m_channels.end()) return;
+      Channel& ch = i->second;
+      if (ch.closing)
+      {
+        if (id == Method(20, 41)) m_channels.erase(i);
+        return;
+      }
+      switch (id)
+      {
+        case Method(20, 40): // channel.close
+          m_broker.cancel(this, channel, std::string());
+          m_channels.erase(i);
+          reply(channel, Method(20, 41));
+          break;
+        case Method(40, 10): // exchange.declare
+          {
+            in.u16();
+            in.shortstr();
+            in.shortstr();
+            if (!(in.u8() & 16)) reply(channel, Method(40, 11));
+          }
+          break;
+        case Method(40, 20): // exchange.delete
+          {
+            in.u16();
+            in.shortstr();
+            if (!(in.u8() & 2)) reply(channel, Method(40, 21));
+          }
+          break;
+        case Method(50, 10): // queue.declare
+          {
+            in.u16();
+            std::string name(in.shortstr());
+            uint8_t bits = in.u8();
+            bool found = true;
+            std::size_t consumers = 0;
+            {
+              std::lock_guard<std::mutex> lock(m_broker.m_mutex);
+              if (bits & 1) found = m_broker.m_queues.count(name);
+              if (found)
+              {
+                if (name.empty())
+                  name = "amq.gen-" + std::to_string(++m_broker.m_queueSeq);
+                consumers = m_broker.m_queues[name].consumers.size();
+              }
+            }
+            if (!found)
+            {
+              notFound(channel, Method(50, 10));
+              break;
+            }
+            if (bits & 16) break;
+            reply(channel, Method(50, 11), [&name, consumers](std::string& out) {
+              PutShort(out, name);
+              Put32(out, 0);
+              Put32(out, consumers);
+            });
+          }
+          break;
+        case Method(50, 20): // queue.bind
+          {
+            in.u16();
+            Binding binding;
+            binding.queue = in.shortstr();
+            binding.exchange = in.shortstr();
+            binding.pattern = in.shortstr();
+            uint8_t bits = in.u8();
+            bool found = false;
+            {
+              std::lock_guard<std::mutex> lock(m_broker.m_mutex);
+              found = m_broker.m_queues.count(binding.queue);
+              if (found)
+              {
+                auto& bindings = m_broker.m_bindings;
+                if (std::find_if(bindings.begin(), bindings.end(),
+                                 [&binding](const Binding& b) {
+                                   return (b.queue == binding.queue) &&
+                                          (b.exchange == binding.exchange) &&
+                                          (b.pattern == binding.pattern);
+                                 }) == bindings.end())
+                  bindings.push_back(binding);
+              }
+            }
+            if (!found) notFound(channel, Method(50, 20));
+              else if (!(bits & 1)) reply(channel, Method(50, 21));
+          }
+          break;
+        case Method(50, 50): // queue.unbind
+          {
+            in.u16();
+            std::string queue(in.shortstr()), exchange(in.shortstr()),
+                        pattern(in.shortstr());
+            {
+              std::lock_guard<std::mutex> lock(m_broker.m_mutex);
+              auto& bindings = m_broker.m_bindings;
+              bindings.erase(
+                std::remove_if(bindings.begin(), bindings.end(),
+                               [&](const Binding& b) {
+                                 return (b.queue == queue) &&
+                                        (b.exchange == exchange) &&
+                                        (b.pattern == pattern);
+                               }),
+                bindings.end()
+              );
+            }
+            reply(channel, Method(50, 51));
+          }
+          break;
+        case Method(50, 30): // queue.purge
+          {
+            in.u16();
+            in.shortstr();
+            if (!(in.u8() & 1))
+              reply(channel, Method(50, 31), [](std::string& out) {
+                Put32(out, 0);
+              });
+          }
+          break;
+        case Method(50, 40): // queue.delete
+          {
+            in.u16();
+            std::string queue(in.shortstr());
+            uint8_t bits = in.u8();
+            {
+              std::lock_guard<std::mutex> lock(m_broker.m_mutex);
+              m_broker.m_queues.erase(queue);
+              auto& bindings = m_broker.m_bindings;
+              bindings.erase(
+                std::remove_if(bindings.begin(), bindings.end(),
+                               [&queue](const Binding& b) {
+                                 return b.queue == queue;
+                               }),
+                bindings.end()
+              );
+            }
+            if (!(bits & 4))
+              reply(channel, Method(50, 41), [](std::string& out) {
+                Put32(out, 0);
+              });
+          }
+          break;
+        case Method(60, 10): // basic.qos
+          reply(channel, Method(60, 11));
+          break;
+        case Method(60, 20): // basic.consume
+          {
+            in.u16();
+            std::string queue(in.shortstr());
+            Consumer consumer;
+            consumer.session = shared_from_this();
+            consumer.owner = this;
+            consumer.channel = channel;
+            consumer.tag = in.shortstr();
+            if (consumer.tag.empty())
+              consumer.tag = "amq.ctag-" + std::to_string(++m_consumerSeq);
+            uint8_t bits = in.u8();
+            bool found = false;
+            {
+              std::lock_guard<std::mutex> lock(m_broker.m_mutex);
+              auto q = m_broker.m_queues.find(queue);
+              found = q != m_broker.m_queues.end();
+              if (found) q->second.consumers.push_back(consumer);
+            }
+            if (!found) notFound(channel, Method(60, 20));
+              else if (!(bits & 8))
+                reply(channel, Method(60, 21), [&consumer](std::string& out) {
+                  PutShort(out, consumer.tag);
+                });
+          }
+          break;
+        case Method(60, 30): // basic.cancel
+          {
+            std::string tag(in.shortstr());
+            m_broker.cancel(this, channel, tag);
+            if (!(in.u8() & 1))
+              reply(channel, Method(60, 31), [&tag](std::string& out) {
+                PutShort(out, tag);
+              });
+          }
+          break;
+        case Method(60, 40): // basic.publish
+          in.u16();
+          ch.exchange = in.shortstr();
+          ch.key = in.shortstr();
+          ch.mandatory = in.u8() & 1;
+          ch.publishing = true;
+          break;
+        case Method(60, 80): // basic.ack
+          {
+            uint64_t tag = in.u64();
+            // consumers acknowledge in order, so a multiple ack covers all
+            // tags since the previous one
+            if ((in.u8() & 1) && (tag > ch.ackedUpTo))
+              m_broker.m_acked += tag - ch.ackedUpTo;
+              else ++m_broker.m_acked;
+            ch.ackedUpTo = std::max(ch.ackedUpTo, tag);
+          }
+          break;
+        case Method(85, 10): // confirm.select
+          ch.confirm = true;
+          if (!(in.u8() & 1)) reply(channel, Method(85, 11));
+          break;
+        default: // basic.reject, basic.nack and the rest are ignored
+          break;
+      }
+    }
+
+    void connectionMethod(uint32_t id, Reader& in)
+    {
+      switch (id)
+      {
+        case Method(10, 11): // connection.start-ok
+          reply(0, Method(10, 30), [](std::string& out) {
+            Put16(out, 2047); // channel max
+            Put32(out, FrameMax);
+            Put16(out, 0); // no heartbeat
+          });
+          break;
+        case Method(10, 31): // connection.tune-ok
+          {
+            in.u16();
+            uint32_t frameMax = in.u32();
+            if (frameMax) m_frameMax = frameMax;
+          }
+          break;
+        case Method(10, 40): // connection.open
+          reply(0, Method(10, 41), [](std::string& out) {
+            PutShort(out, std::string());
+          });
+          break;
+        case Method(10, 50): // connection.close
+          m_broker.cancel(this, 0, std::string());
+          m_channels.clear();
+          reply(0, Method(10, 51));
+          break;
+        default:
+          break;
+      }
+    }
+
+    ///
+    /// Ответить методом.
+    ///
+    void reply(uint16_t channel, uint32_t id,
+               const std::function<void(std::string&)>& args = nullptr)
+    {
+      std::size_t at = BeginMethod(m_out, channel, id);
+      if (args) args(m_out);
+      EndFrame(m_out, at);
+    }
+
+    ///
+    /// Закрыть канал: очередь не найдена.
+    ///
+    void notFound(uint16_t channel, uint32_t id)
+    {
+      m_channels[channel].closing = true;
+      m_broker.cancel(this, channel, std::string());
+      reply(channel, Method(20, 40), [id](std::string& out) {
+        Put16(out, 404);
+        PutShort(out, "NOT_FOUND - no queue");
+        Put32(out, id);
+      });
+    }
+
+    ///
+    /// Отправить заголовок и тело сообщения.
+    ///
+    void content(uint16_t channel, const std::string& header,
+                 const std::string& body)
+    {
+      std::size_t at = BeginFrame(m_out, eHeaderFrame, channel);
+      m_out.append(header);
+      EndFrame(m_out, at);
+      std::size_t chunk = m_frameMax - FrameOverhead;
+      for (std::size_t offset = 0; offset < body.size(); offset += chunk)
+      {
+        at = BeginFrame(m_out, eBodyFrame, channel);
+        m_out.append(body, offset, chunk);
+        EndFrame(m_out, at);
+      }
+    }
+
+    ///
+    /// Маршрутизировать принятую публикацию.
+    ///
+    void publish(uint16_t channel, Channel& ch)
+    {
+      ch.publishing = false;
+      ++m_broker.m_published;
+      if (ch.confirm) ++ch.publishSeq;
+      std::vector<Consumer> consumers;
+      if (!m_broker.route(ch.exchange, ch.key, consumers) && ch.mandatory)
+      {
+        std::size_t at = BeginMethod(m_out, channel, Method(60, 50));
+        Put16(m_out, 312);
+        PutShort(m_out, "NO_ROUTE");
+        PutShort(m_out, ch.exchange);
+        PutShort(m_out, ch.key);
+        EndFrame(m_out, at);
+        content(channel, *ch.header, *ch.body);
+      }
+      std::shared_ptr<const std::string> header(ch.header), body(ch.body);
+      for (auto& consumer: consumers)
+        Deliver(consumer, header, body, ch.exchange, ch.key);
+    }
+
+    ///
+    /// Подтвердить публикации, принятые за один прием.
+    ///
+    void confirm()
+    {
+      for (auto& i: m_channels)
+      {
+        Channel& ch = i.second;
+        if (!ch.confirm || (ch.publishSeq == ch.confirmed)) continue;
+        bool multiple = ch.publishSeq - ch.confirmed > 1;
+        reply(i.first, Method(60, 80), [&ch, multiple](std::string& out) {
+          Put64(out, ch.publishSeq);
+          Put8(out, multiple ? 1 : 0);
+        });
+        ch.confirmed = ch.publishSeq;
+      }
+    }
+
+    ///
+    /// Отправить накопленные ответы.
+    ///
+    void flush()
+    {
+      if (m_out.empty()) return;
+      if (m_socket)
+      {
+        if (m_writing.empty()) write();
+        return;
+      }
+      std::shared_ptr<LoopbackTransport> transport(m_loopback.lock());
+      if (transport) transport->deliver(m_out.data(), m_out.size());
+      m_out.clear();
+    }
+
+    void read()
+    {
+      auto self(shared_from_this());
+      m_socket->async_read_some(boost::asio::buffer(m_readBuf),
+        m_strand.wrap([this, self](const boost::system::error_code& ec,
+                                   std::size_t bytes) {
+          if (ec)
+          {
+            m_broker.cancel(this, 0, std::string());
+            return;
+          }
+          feed(m_readBuf.data(), bytes);
+          read();
+        })
+      );
+    }
+
+    void write()
+    {
+      m_writing.swap(m_out);
+      auto self(shared_from_this());
+      boost::asio::async_write(*m_socket, boost::asio::buffer(m_writing),
+        m_strand.wrap([this, self](const boost::system::error_code& ec,
+                                   std::size_t) {
+          m_writing.clear();
+          if (!ec && !m_out.empty()) write();
+        })
+      );
+    }
+
+    FakeBroker& m_broker;
+    std::weak_ptr<LoopbackTransport> m_loopback;
+    std::string m_in, ///< Неразобранные данные клиента.
+                m_out, ///< Ответы, ожидающие отправки.
+                m_writing; ///< Ответы, отправляемые через сокет.
+    std::vector<char> m_readBuf;
+    std::map<uint16_t, Channel> m_channels;
+    uint32_t m_frameMax;
+    bool m_greeted;
+    uint64_t m_consumerSeq;
+};
+
+FakeBroker::FakeBroker(boost::asio::io_service& service):
+  m_service(service),
+  m_queueSeq(0),
+  m_published(0),
+  m_delivered(0),
+  m_acked(0)
+{
+}
+
+FakeBroker::~FakeBroker()
+{
+  if (m_acceptor)
+  {
+    boost::system::error_code ec;
+    m_acceptor->close(ec);
+    std::remove(m_path.c_str());
+  }
+}
+
+TransportFactory FakeBroker::factory()
+{
+  return [this](const boost::asio::io_service::strand& strand) {
+    std::shared_ptr<Session> session = std::make_shared<Session>(*this, strand);
+    std::shared_ptr<LoopbackTransport> transport =
+      std::make_shared<LoopbackTransport>(strand,
+        [session](const char* data, std::size_t size) {
+          session->feed(data, size);
+        });
+    session->attach(transport);
+    return std::shared_ptr<Transport>(transport);
+  };
+}
+
+void FakeBroker::listen(const std::string& path)
+{
+  std::remove(path.c_str());
+  m_path = path;
+  m_acceptor.reset(new boost::asio::local::stream_protocol::acceptor(
+    m_service, boost::asio::local::stream_protocol::endpoint(path)
+  ));
+  accept();
+}
+
+std::size_t FakeBroker::inject(const std::string& queue,
+                               const std::string& body, std::size_t count)
+{
+  std::vector< std::pair<Consumer, std::size_t> > shares;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto i = m_queues.find(queue);
+    if (i == m_queues.end()) return 0;
+    Queue& q = i->second;
+    Consumer consumer;
+    // the first pass drops the consumers of closed connections
+    if (!Next(q, consumer)) return 0;
+    std::size_t n = q.consumers.size();
+    for (std::size_t k = 0; (k < n) && (k < count); ++k)
+    {
+      if (k) Next(q, consumer);
+      shares.push_back(std::make_pair(consumer, count / n + (k < count % n)));
+    }
+  }
+  std::shared_ptr<const std::string> header =
+    std::make_shared<std::string>(ContentHeader(body.size()));
+  std::shared_ptr<const std::string> content =
+    std::make_shared<std::string>(body);
+  for (auto& share: shares)
+    Deliver(share.first, header, content, std::string(), queue, share.second);
+  return count;
+}
+
+void FakeBroker::accept()
+{
+  std::shared_ptr<Session> session = std::make_shared<Session>(*this,
+    boost::asio::io_service::strand(m_service));
+  session->m_socket.reset(
+    new boost::asio::local::stream_protocol::socket(m_service)
+  );
+  m_acceptor->async_accept(*session->m_socket,
+    [this, session](const boost::system::error_code& ec) {
+      if (ec) return;
+      session->open();
+      accept();
+    }
+  );
+}
+
+bool FakeBroker::Next(Queue& queue, Consumer& consumer)
+{
+  while (!queue.consumers.empty())
+  {
+    if (queue.next >= queue.consumers.size()) queue.next = 0;
+    auto i = queue.consumers.begin() + queue.next;
+    if (i->session.expired())
+    {
+      queue.consumers.erase(i);
+      continue;
+    }
+    consumer = *i;
+    ++queue.next;
+    return true;
+  }
+  return false;
+}
+
+void FakeBroker::cancel(const Session* owner, uint16_t channel,
+                        const std::string& tag)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto& i: m_queues)
+  {
+    auto& consumers = i.second.consumers;
+    consumers.erase(
+      std::remove_if(consumers.begin(), consumers.end(),
+                     [&](const Consumer& c) {
+                       return (c.owner == owner) &&
+                              (!channel || (c.channel == channel)) &&
+                              (tag.empty() || (c.tag == tag));
+                     }),
+      consumers.end()
+    );
+  }
+}
+
+bool FakeBroker::route(const std::string& exchange, const std::string& key,
+                       std::vector<Consumer>& consumers)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::set<std::string> queues;
+  // the default exchange routes to the queue named by the key
+  if (exchange.empty())
+  {
+    if (m_queues.count(key)) queues.insert(key);
+  }
+  else
+    for (auto& binding: m_bindings)
+      if ((binding.exchange == exchange) && Match(binding.pattern, key))
+        queues.insert(binding.queue);
+  for (auto& name: queues)
+  {
+    Consumer consumer;
+    if (Next(m_queues[name], consumer)) consumers.push_back(consumer);
+  }
+  return !queues.empty();
+}
+
+void FakeBroker::Deliver(const Consumer& consumer,
+                         const std::shared_ptr<const std::string>& header,
+                         const std::shared_ptr<const std::string>& body,
+                         const std::string& exchange, const std::string& key,
+                         std::size_t count)
+{
+  std::shared_ptr<Session> session(consumer.session.lock());
+  if (!session) return;
+  uint16_t channel = consumer.channel;
+  std::string tag(consumer.tag);
+  // inline when the consumer shares the strand of the publisher
+  session->m_strand.dispatch(
+    [session, channel, tag, header, body, exchange, key, count]() {
+      session->deliver(channel, tag, *header, *body, exchange, key, count);
+    }
+  );
+}
+
+bool FakeBroker::Match(const std::string& pattern, const std::string& key)
+{
+  // split both on dots, '*' matches one word, '#' zero or more
+  auto split = [](const std::string& s) {
+    std::vector<std::string> words;
+    std::size_t begin = 0;
+    for (;;)
+    {
+      std::size_t end = s.find('.', begin);
+      words.push_back(s.substr(begin, end - begin));
+      if (end == std::string::npos) break;
+      begin = end + 1;
+    }
+    return words;
+  };
+  std::vector<std::string> p(split(pattern)), k(split(key));
+  std::function<bool(std::size_t, std::size_t)> match =
+    [&](std::size_t i, std::size_t j) -> bool {
+      if (i == p.size()) return j == k.size();
+      if (p[i] == "#")
+      {
+        for (std::size_t n = j; n <= k.size(); ++n)
+          if (match(i + 1, n)) return true;
+        return false;
+      }
+      if (j == k.size()) return false;
+      return ((p[i] == "*") || (p[i] == k[j])) && match(i + 1, j + 1);
+    };
+  return match(0, 0);
+}
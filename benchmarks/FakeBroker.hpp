@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include "../src/AmqpTransport.hpp"
+
+namespace amqp {
+namespace bench {
+
+///
+/// Имитатор брокера AMQP 0-9-1 для замеров производительности.
+
+/// Реализует ровно то подмножество протокола, которое использует
+/// библиотека: рукопожатие соединения, открытие и закрытие каналов,
+/// объявление точек обмена (все -- topic), очередей, привязки, подписку,
+/// публикацию с маршрутизацией и возвратом (mandatory), подтверждение
+/// публикаций (confirm.select). Сообщения не хранятся: если у очереди нет
+/// подписчика, сообщение отбрасывается. Подписчикам очереди сообщения
+/// раздаются по кругу, подтверждения подписчиков только подсчитываются.
+///
+/// Соединения принимаются двумя способами: в памяти процесса через
+/// amqp::LoopbackTransport (factory()) и через сокет домена Unix (listen()),
+/// чтобы замерять и путь ввода/вывода boost::asio (epoll или io_uring).
+///
+/// Методы inject() и счетчики можно вызывать из любого потока.
+///
+/// @author cycleg
+///
+class FakeBroker
+{
+  public:
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] service Служба ввода/вывода для соединений через сокет.
+    ///
+    explicit FakeBroker(boost::asio::io_service& service);
+    ///
+    /// Деструктор.
+    ///
+    ~FakeBroker();
+
+    ///
+    /// Фабрика транспорта для ConnectionOptions::transportFactory.
+    ///
+    /// @return Фабрика, создающая соединения с брокером в памяти процесса.
+    ///
+    TransportFactory factory();
+    ///
+    /// Принимать соединения через сокет домена Unix.
+    ///
+    /// @param [in] path Путь к сокету. Существующий файл удаляется.
+    ///
+    void listen(const std::string& path);
+    ///
+    /// Раздать сообщения подписчикам очереди.
+    ///
+    /// @param [in] queue Имя очереди.
+    /// @param [in] body Тело сообщения.
+    /// @param [in] count Число сообщений.
+    /// @return Число отправленных сообщений (нуль, если подписчиков нет).
+    ///
+    std::size_t inject(const std::string& queue, const std::string& body,
+                       std::size_t count);
+
+    ///
+    /// Число принятых от клиентов публикаций.
+    ///
+    inline uint64_t published() const { return m_published; }
+    ///
+    /// Число доставленных подписчикам сообщений.
+    ///
+    inline uint64_t delivered() const { return m_delivered; }
+    ///
+    /// Число полученных от подписчиков подтверждений (basic.ack).
+    ///
+    inline uint64_t acked() const { return m_acked; }
+
+  private:
+    class Session;
+    friend class Session;
+
+    ///
+    /// Подписчик очереди.
+    ///
+    struct Consumer
+    {
+      std::weak_ptr<Session> session; ///< Соединение подписчика.
+      const Session* owner; ///< Соединение подписчика (для поиска).
+      uint16_t channel; ///< Канал подписчика.
+      std::string tag; ///< Тэг подписчика.
+    };
+
+    ///
+    /// Очередь.
+    ///
+    struct Queue
+    {
+      std::vector<Consumer> consumers; ///< Подписчики.
+      std::size_t next = 0; ///< Индекс следующего подписчика.
+    };
+
+    ///
+    /// Привязка очереди к точке обмена.
+    ///
+    struct Binding
+    {
+      std::string exchange, ///< Точка обмена.
+                  pattern, ///< Шаблон ключа маршрутизации (topic).
+                  queue; ///< Очередь.
+    };
+
+    ///
+    /// Начать прием соединений через сокет.
+    ///
+    void accept();
+    ///
+    /// Выбрать следующего подписчика очереди.
+    ///
+    /// @param [in,out] queue Очередь.
+    /// @param [out] consumer Подписчик.
+    /// @return false, если у очереди нет подписчиков.
+    ///
+    /// Подписчики закрытых соединений удаляются из очереди.
+    ///
+    static bool Next(Queue& queue, Consumer& consumer);
+    ///
+    /// Отменить подписки соединения.
+    ///
+    /// @param [in] owner Соединение.
+    /// @param [in] channel Канал. 0 -- все каналы соединения.
+    /// @param [in] tag Тэг подписчика. Пустая строка -- все подписки канала.
+    ///
+    void cancel(const Session* owner, uint16_t channel, const std::string& tag);
+    ///
+    /// Выбрать подписчиков для публикации.
+    ///
+    /// @param [in] exchange Точка обмена.
+    /// @param [in] key Ключ маршрутизации.
+    /// @param [out] consumers Подписчики, по одному на каждую очередь с
+    ///                        подписчиками.
+    /// @return true, если маршрут нашелся хотя бы для одной очереди.
+    ///
+    bool route(const std::string& exchange, const std::string& key,
+               std::vector<Consumer>& consumers);
+    ///
+    /// Доставить сообщение подписчику в контексте его соединения.
+    ///
+    /// @param [in] consumer Подписчик.
+    /// @param [in] header Содержимое кадра заголовка сообщения.
+    /// @param [in] body Тело сообщения.
+    /// @param [in] exchange Точка обмена.
+    /// @param [in] key Ключ маршрутизации.
+    /// @param [in] count Число копий сообщения.
+    ///
+    static void Deliver(const Consumer& consumer,
+                        const std::shared_ptr<const std::string>& header,
+                        const std::shared_ptr<const std::string>& body,
+                        const std::string& exchange, const std::string& key,
+                        std::size_t count = 1);
+    ///
+    /// Проверить ключ маршрутизации по шаблону topic.
+    ///
+    /// @param [in] pattern Шаблон (слова через точку, * и #).
+    /// @param [in] key Ключ маршрутизации.
+    /// @return Совпадают или нет.
+    ///
+    static bool Match(const std::string& pattern, const std::string& key);
+
+    boost::asio::io_service& m_service; ///< Служба ввода/вывода.
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor>
+      m_acceptor; ///< Прием соединений через сокет.
+    std::string m_path; ///< Путь к сокету.
+    std::mutex m_mutex; ///< Защита очередей и привязок.
+    std::map<std::string, Queue> m_queues; ///< Очереди по имени.
+    std::vector<Binding> m_bindings; ///< Привязки очередей.
+    uint64_t m_queueSeq; ///< Счетчик для имен безымянных очередей.
+    std::atomic<uint64_t> m_published, ///< Принято публикаций.
+                          m_delivered, ///< Доставлено сообщений.
+                          m_acked; ///< Получено подтверждений.
+};
+
+} // namespace bench
+} // namespace amqp
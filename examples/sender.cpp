@@ -33,21 +33,22 @@ int main(int argc, char* argv[])
     std::cout << "AMQP client finished with code " << code << std::endl;
   });
   m_amqpClient->start([m_amqpClient, trn, &content, &stopSignals]() {
-    m_amqpClient->connector()->run();
-    std::cout << "AMQP client started" << std::endl;
-    if (trn->send(content, amqpRoute, false))
-      std::cout << "Raw message send." << std::endl;
-      else std::cout << "Message not send." << std::endl;
-    rapidjson::Document msg;
-    if (!msg.Parse(content.c_str()).HasParseError())
-      {
-        if (trn->send(msg, amqpRoute, false))
-          std::cout << "JSON send." << std::endl;
-          else std::cout << "JSON not send." << std::endl;
-      }
-      else std::cout << "Content isn't JSON." << std::endl;
-    m_amqpClient->stop();
-    stopSignals.cancel();
+    m_amqpClient->connector()->run([m_amqpClient, trn, &content, &stopSignals]() {
+      std::cout << "AMQP client started" << std::endl;
+      if (trn->send(content, amqpRoute, false))
+        std::cout << "Raw message send." << std::endl;
+        else std::cout << "Message not send." << std::endl;
+      rapidjson::Document msg;
+      if (!msg.Parse(content.c_str()).HasParseError())
+        {
+          if (trn->send(msg, amqpRoute, false))
+            std::cout << "JSON send." << std::endl;
+            else std::cout << "JSON not send." << std::endl;
+        }
+        else std::cout << "Content isn't JSON." << std::endl;
+      m_amqpClient->stop();
+      stopSignals.cancel();
+    });
   });
   io_service.run();
   return EXIT_SUCCESS;
@@ -0,0 +1,107 @@
+#include "AmqpAckHandle.hpp"
+#include "AmqpTransceiver.hpp"
+
+using namespace amqp;
+
+AckQueue::AckQueue(PostCallback post):
+  m_head(nullptr),
+  m_post(post)
+{
+}
+
+AckQueue::~AckQueue()
+{
+  Node* node = m_head.exchange(nullptr);
+  while (node)
+  {
+    Node* next = node->next;
+    delete node;
+    node = next;
+  }
+}
+
+void AckQueue::push(uint64_t generation, AMQP::Channel* channel,
+                    uint64_t deliveryTag, Action action)
+{
+  Node* head = m_head.load(std::memory_order_relaxed);
+  Node* node = new Node{ head, generation, channel, deliveryTag, action };
+  while (!m_head.compare_exchange_weak(head, node,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+    node->next = head;
+  // the first action after a drain schedules the next one; the node itself
+  // may already belong to drain()
+  if (head || !m_post) return;
+  std::shared_ptr<AckQueue> self(shared_from_this());
+  m_post([self](Transceiver& transceiver) { self->drain(transceiver); });
+}
+
+void AckQueue::drain(Transceiver& transceiver)
+{
+  Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+  // the stack holds the newest action first
+  Node* fifo = nullptr;
+  while (node)
+  {
+    Node* next = node->next;
+    node->next = fifo;
+    fifo = node;
+    node = next;
+  }
+  while (fifo)
+  {
+    Node* next = fifo->next;
+    // delivery tags of a previous channel mean nothing to the current one
+    if ((fifo->generation == transceiver.generation()) && fifo->channel)
+      switch (fifo->action)
+      {
+        case eAck:
+          transceiver.ack(fifo->deliveryTag, fifo->channel);
+          break;
+        case eReject:
+          transceiver.reject(fifo->deliveryTag, false, fifo->channel);
+          break;
+        case eRequeue:
+          transceiver.reject(fifo->deliveryTag, true, fifo->channel);
+          break;
+      }
+    delete fifo;
+    fifo = next;
+  }
+}
+
+AckHandle::AckHandle():
+  m_generation(0),
+  m_channel(nullptr),
+  m_deliveryTag(0)
+{
+}
+
+AckHandle::AckHandle(const std::shared_ptr<AckQueue>& queue,
+                     uint64_t generation, AMQP::Channel* channel,
+                     uint64_t deliveryTag):
+  m_queue(queue),
+  m_generation(generation),
+  m_channel(channel),
+  m_deliveryTag(deliveryTag)
+{
+}
+
+bool AckHandle::ack()
+{
+  return complete(AckQueue::eAck);
+}
+
+bool AckHandle::reject(bool requeue)
+{
+  return complete(requeue ? AckQueue::eRequeue : AckQueue::eReject);
+}
+
+bool AckHandle::complete(AckQueue::Action action)
+{
+  if (!m_queue) return false;
+  std::shared_ptr<AckQueue> queue;
+  queue.swap(m_queue);
+  queue->push(m_generation, m_channel, m_deliveryTag, action);
+  return true;
+}
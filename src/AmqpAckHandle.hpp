@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace AMQP {
+
+class Channel;
+
+} // namespace AMQP
+
+namespace amqp {
+
+class Transceiver;
+
+///
+/// Очередь подтверждений входящих сообщений из произвольных потоков.
+
+/// Принадлежит приемопередатчику и разделяется его экземплярами AckHandle.
+/// Потоки добавляют в нее подтверждения и отказы без блокировок (стек на
+/// атомарном указателе), а разбирает их метод drain() в strand коннектора.
+/// Задача разбора ставится в strand, только когда очередь была пуста, так
+/// что подтверждения, накопившиеся до ее выполнения, разбираются одной
+/// порцией.
+///
+/// @author cycleg
+///
+class AckQueue: public std::enable_shared_from_this<AckQueue>
+{
+  public:
+    ///
+    /// Действие с сообщением.
+    ///
+    enum Action : uint8_t
+    {
+      eAck, ///< Подтвердить.
+      eReject, ///< Отвергнуть.
+      eRequeue ///< Отвергнуть и вернуть в очередь.
+    };
+
+    ///
+    /// Указатель на функцию, выполняющую задачу в strand коннектора с
+    /// приемопередатчиком, если он еще существует.
+    ///
+    typedef std::function<void(
+      std::function<void(Transceiver& transceiver)> task
+    )> PostCallback;
+
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] post Передача задачи в strand коннектора.
+    ///
+    explicit AckQueue(PostCallback post);
+    ///
+    /// Деструктор.
+    ///
+    ~AckQueue();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    AckQueue(const AckQueue&) = delete;
+
+    ///
+    /// Добавить действие с сообщением. Вызывается из любого потока.
+    ///
+    /// @param [in] generation Поколение канала, из которого получено
+    ///                        сообщение.
+    /// @param [in] channel Канал, из которого получено сообщение.
+    /// @param [in] deliveryTag Метка сообщения.
+    /// @param [in] action Действие.
+    ///
+    void push(uint64_t generation, AMQP::Channel* channel,
+              uint64_t deliveryTag, Action action);
+    ///
+    /// Выполнить накопленные действия в порядке добавления.
+    ///
+    /// @param [in] transceiver Приемопередатчик.
+    ///
+    /// Вызывается в strand коннектора. Действия с сообщениями из канала
+    /// прежнего поколения (см. Transceiver::generation()) отбрасываются.
+    ///
+    void drain(Transceiver& transceiver);
+
+  private:
+    ///
+    /// Элемент стека действий.
+    ///
+    struct Node
+    {
+      Node* next; ///< Добавленный ранее элемент.
+      uint64_t generation; ///< Поколение канала.
+      AMQP::Channel* channel; ///< Канал, только для сравнения.
+      uint64_t deliveryTag; ///< Метка сообщения.
+      Action action; ///< Действие.
+    };
+
+    std::atomic<Node*> m_head; ///< Последнее добавленное действие.
+    PostCallback m_post; ///< Передача задачи в strand коннектора.
+};
+
+///
+/// Отложенное подтверждение входящего сообщения.
+
+/// Выдается приемопередатчиком (Transceiver::ackHandle()) в обработчике
+/// входящего сообщения и может быть завершено из любого потока методом
+/// ack() или reject(), в том числе после возврата из обработчика. Само
+/// подтверждение отправляется брокеру в strand коннектора, через
+/// Transceiver::ack() и Transceiver::reject(), поэтому действует накопление
+/// подтверждений (Transceiver::coalesceAcks()).
+///
+/// Экземпляр запоминает поколение канала приемопередатчика. Если канал
+/// сменился (переподключение, перезапуск приемопередатчика) или
+/// приемопередатчик удален, завершение молча отбрасывается: метка
+/// сообщения в новом канале ничего не значит, а брокер сам вернет
+/// сообщение в очередь.
+///
+/// Экземпляр можно только перемещать и завершить один раз.
+///
+/// @author cycleg
+///
+class AckHandle
+{
+  public:
+    ///
+    /// Конструктор пустого экземпляра.
+    ///
+    AckHandle();
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] queue Очередь подтверждений приемопередатчика.
+    /// @param [in] generation Поколение канала.
+    /// @param [in] channel Канал, из которого получено сообщение.
+    /// @param [in] deliveryTag Метка сообщения.
+    ///
+    AckHandle(const std::shared_ptr<AckQueue>& queue, uint64_t generation,
+              AMQP::Channel* channel, uint64_t deliveryTag);
+
+    AckHandle(AckHandle&&) = default;
+    AckHandle& operator=(AckHandle&&) = default;
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    AckHandle(const AckHandle&) = delete;
+    AckHandle& operator=(const AckHandle&) = delete;
+
+    ///
+    /// Экземпляр выдан приемопередатчиком и еще не завершен.
+    ///
+    /// @return Действителен или нет.
+    ///
+    inline bool valid() const { return bool(m_queue); }
+    ///
+    /// Метка сообщения.
+    ///
+    /// @return Метка.
+    ///
+    inline uint64_t deliveryTag() const { return m_deliveryTag; }
+
+    ///
+    /// Подтвердить сообщение.
+    ///
+    /// @return false, если экземпляр недействителен.
+    ///
+    bool ack();
+    ///
+    /// Отвергнуть сообщение.
+    ///
+    /// @param [in] requeue Вернуть сообщение в очередь (необязательный).
+    /// @return false, если экземпляр недействителен.
+    ///
+    bool reject(bool requeue = true);
+
+  private:
+    ///
+    /// Передать действие в очередь и сделать экземпляр недействительным.
+    ///
+    /// @param [in] action Действие.
+    /// @return false, если экземпляр недействителен.
+    ///
+    bool complete(AckQueue::Action action);
+
+    std::shared_ptr<AckQueue> m_queue; ///< Очередь подтверждений.
+    uint64_t m_generation; ///< Поколение канала.
+    AMQP::Channel* m_channel; ///< Канал, только для сравнения.
+    uint64_t m_deliveryTag; ///< Метка сообщения.
+};
+
+} // namespace amqp
@@ -1,37 +1,93 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #ifndef NDEBUG
 #include <iostream>
 #endif
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include "AmqpConnectionHandler.hpp"
+#include "AmqpTrace.hpp"
 
 #define UNUSED(x) (void)x;
 
 using namespace amqp;
 
+namespace {
+
+///
+/// Подсчитать кадры AMQP в разобранных данных.
+///
+/// @param [in] data Начало данных.
+/// @param [in] size Объем данных, содержащих только целые кадры.
+/// @return Число кадров.
+///
+/// Кадр AMQP 0-9-1: тип (1 байт), канал (2), размер (4), данные, конец
+/// кадра (1). Обходятся только заголовки, данные не читаются.
+///
+uint64_t CountFrames(const char* data, uint64_t size)
+{
+  uint64_t frames = 0;
+  for (uint64_t offset = 0; offset + 7 <= size; ++frames)
+  {
+    const unsigned char* header =
+      reinterpret_cast<const unsigned char*>(data + offset);
+    uint32_t payload = (uint32_t(header[3]) << 24) | (uint32_t(header[4]) << 16) |
+                       (uint32_t(header[5]) << 8) | uint32_t(header[6]);
+    offset += 8 + uint64_t(payload);
+  }
+  return frames;
+}
+
+} // namespace
+
 ConnectionHandler::ConnectionHandler(boost::asio::io_service& service,
-                                     const std::string& host,
-                                     const std::string& port,
-                                     ShutdownCallback shutdownCb):
+                                     const boost::asio::io_service::strand& strand,
+                                     std::shared_ptr<Transport> transport,
+                                     const ConnectionOptions& options,
+                                     ShutdownCallback shutdownCb,
+                                     std::shared_ptr<ConnectionCounters> counters):
   m_service(service),
-  m_socket(m_service),
-  m_inBuf(std::make_shared<boost::asio::streambuf>()),
-  m_host(host),
-  m_port(port),
+  m_strand(strand),
+  m_transport(transport),
+  m_registered(0),
+  m_readSize(0),
+  m_requested(0),
+  m_smallReads(0),
+  m_captureId(0),
+  m_options(options),
+  m_outHead(0),
+  m_sendCount(0),
+  m_pendingBytes(0),
+  m_outBytes(0),
+  m_lingerTimer(m_service),
+  m_heartbeatTimer(m_service),
+  m_heartbeat(0),
   m_connection(nullptr),
   m_state(eNotConnected),
-  m_resolver(m_service),
   m_connectedCb(nullptr),
   m_shutdownCb(shutdownCb),
+  m_writableCb(nullptr),
   m_amqpError(false),
   m_readReq(false),
-  m_writeReq(false)
+  m_writeReq(false),
+  m_lingerReq(false),
+  m_heartbeatReq(false),
+  m_connectReq(false),
+  m_connectionLost(false),
+  m_corked(false),
+  m_congested(false),
+  m_counters(counters ? counters : std::make_shared<ConnectionCounters>())
 {
 }
 
 ConnectionHandler::~ConnectionHandler()
 {
-  stop();
+  // the transport may outlive the instance while its operations complete
+  m_transport->close();
+  // frames queued after the last write go back to the pool, which frees them
+  for (std::size_t i = m_outHead; i < m_outBufs.size(); ++i)
+    m_framePool.release(m_outBufs[i]);
 }
 
 void ConnectionHandler::start(ConnectedCallback connected)
@@ -39,7 +95,26 @@ void ConnectionHandler::start(ConnectedCallback connected)
   if (m_state != eNotConnected) return;
   m_connectedCb = connected;
   m_amqpError = false;
-  m_state = eResolving;
+  m_readSize = m_options.receiveBufferMin;
+  m_smallReads = 0;
+  m_connectionLost = false;
+  m_heartbeat = 0;
+  // the counters outlive the previous connection and its queue
+  updateQueueStats();
+  if (m_options.wireCapture) m_captureId = m_options.wireCapture->begin();
+  // pending operations hold the instance: the kernel may still write into
+  // the input buffer and read the gather list; the callbacks are released
+  // when the shutdown is finished
+  auto self(shared_from_this());
+  m_transport->onRead([self](const boost::system::error_code& ec,
+                             std::size_t bytes) {
+    self->onRead(ec, bytes);
+  });
+  m_transport->onWrite([self](const boost::system::error_code& ec,
+                              std::size_t bytes) {
+    self->onWrite(ec, bytes);
+  });
+  m_state = eConnecting;
   StateMachine();
 }
 
@@ -54,15 +129,25 @@ std::clog << "ConnectionHandler::stop()" << std::endl;
   StateMachine();
 }
 
-#if 0
 uint16_t ConnectionHandler::onNegotiate(AMQP::Connection* connection,
-                                            uint16_t interval)
+                                        uint16_t interval)
 {
   if (!m_connection) m_connection = connection;
-  // default implementation, suggested heartbeat is ok
-  return interval;
-}
+  // AMQP 0-9-1: the lower of the proposed values, zero means "no heartbeat"
+  if (!m_options.heartbeat) m_heartbeat = 0;
+    else if (!interval || (m_options.heartbeat < interval))
+      m_heartbeat = m_options.heartbeat;
+    else m_heartbeat = interval;
+#ifndef NDEBUG
+std::clog << "ConnectionHandler::onNegotiate() suggested " << interval << ", heartbeat " << m_heartbeat << std::endl;
 #endif
+  if (m_heartbeat && (m_state == eReady))
+  {
+    m_lastRead = m_lastWrite = std::chrono::steady_clock::now();
+    if (!m_heartbeatReq) scheduleHeartbeat();
+  }
+  return m_heartbeat;
+}
 
 void ConnectionHandler::onData(AMQP::Connection* connection,
                                const char* buffer, size_t size)
@@ -74,26 +159,69 @@ void ConnectionHandler::onData(AMQP::Connection* connection,
     m_state = eReady;
     StateMachine();
   }
-  auto outBuf(std::make_shared< boost::asio::streambuf >());
-  std::ostream os(outBuf.get());
-  os.write(buffer, size);
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onData() " << uint64_t(outBuf.get()) << " size = " << outBuf->size() << std::endl;
-#endif
-  m_outBufs.push(outBuf);
-  if (!m_writeReq)
+  FrameBuffer frame(m_framePool.acquire(size));
+  std::memcpy(frame.data, buffer, size);
+  m_outBufs.push_back(frame);
+  m_pendingBytes += size;
+  m_outBytes += size;
+  AMQPASIO_TRACE_DEBUG(eData, this, size, m_outBytes.load());
+  ConnectionCounters::Add(m_counters->framesOut);
+  updateQueueStats();
+  if (!m_congested && m_options.highWatermark &&
+      (m_outBytes >= m_options.highWatermark))
   {
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onData() wait for write " << m_outBufs.size() << std::endl;
-#endif
-    m_writeReq = true;
-    boost::asio::async_write(
-      m_socket, *m_outBufs.front().get(),
-      boost::bind(&ConnectionHandler::onWrite, this,
-                  boost::asio::placeholders::error,
-                  boost::asio::placeholders::bytes_transferred)
-    );
+    m_congested = true;
+    if (m_writableCb) m_writableCb(false);
   }
+  // frames arrived during transmission join the next batch
+  if (m_writeReq || m_corked) return;
+  if (m_options.writeLinger &&
+      (!m_options.maxBatchBytes || (m_pendingBytes < m_options.maxBatchBytes)))
+  {
+    if (!m_lingerReq)
+    {
+      m_lingerReq = true;
+      m_lingerTimer.expires_from_now(
+        std::chrono::microseconds(m_options.writeLinger)
+      );
+      auto self(shared_from_this());
+      m_lingerTimer.async_wait(m_strand.wrap(
+        [this, self](const boost::system::error_code& ec) {
+          m_lingerReq = false;
+          if (m_state == eShutdown)
+          {
+            // finish shutdown
+            StateMachine();
+            return;
+          }
+          if ((ec == boost::asio::error::operation_aborted) || !connected())
+            return;
+          flush();
+        }
+      ));
+    }
+    return;
+  }
+  flush();
+}
+
+void ConnectionHandler::detach()
+{
+  m_connectedCb = nullptr;
+  m_shutdownCb = nullptr;
+  m_writableCb = nullptr;
+}
+
+void ConnectionHandler::cork()
+{
+  m_corked = true;
+}
+
+void ConnectionHandler::uncork()
+{
+  if (!m_corked) return;
+  m_corked = false;
+  if (connected()) flush();
 }
 
 void ConnectionHandler::onError(AMQP::Connection* connection,
@@ -127,56 +255,39 @@ void ConnectionHandler::StateMachine()
 {
   switch (m_state)
   {
-    case eResolving:
+    case eConnecting:
 #ifndef NDEBUG
-std::clog << "ConnectionHandler::StateMachine() before async_resolve()" << std::endl;
+std::clog << "ConnectionHandler::StateMachine() before connect()" << std::endl;
 #endif
       {
         auto work = std::make_shared<boost::asio::io_service::work>(m_service);
         m_sentinel.swap(work);
       }
-      m_resolver.async_resolve(boost::asio::ip::tcp::resolver::query(m_host, m_port),
-                               [this](const boost::system::error_code& ec,
-                                      boost::asio::ip::tcp::resolver::iterator i) {
-        // something happened...
-        if (m_state != eResolving) return;
-        if (ec) {
-          m_lastError = "failed to resolve: ";
-          m_lastError.append(ec.message());
-          m_state = eNotConnected;
-          StateMachine();
-          return;
-        }
-        m_rIterator = i;
-        m_state = eConnecting;
-        StateMachine();
-      });
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::StateMachine() after async_resolve()" << std::endl;
-#endif
-      break;
-    case eConnecting:
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::StateMachine() before async_connect()" << std::endl;
-#endif
-      boost::asio::async_connect(m_socket, m_rIterator,
-                                 [this](const boost::system::error_code& ec,
-                                        boost::asio::ip::tcp::resolver::iterator i) {
-        if (m_state != eConnecting) return;
-        if (ec || (i == boost::asio::ip::tcp::resolver::iterator()))
-        {
-          m_lastError = "failed to connect: ";
-          m_lastError.append(ec.message());
-          m_state = eNotConnected;
+      {
+        m_connectReq = true;
+        auto self(shared_from_this());
+        m_transport->connect([this, self](const std::string& error) {
+          m_connectReq = false;
+          if (m_state == eShutdown)
+          {
+            // connecting cancelled by stop(), finish shutdown
+            StateMachine();
+            return;
+          }
+          if (m_state != eConnecting) return;
+          AMQPASIO_TRACE_INFO(eConnect, this, !error.empty(), 0);
+          if (!error.empty())
+          {
+            m_lastError = error;
+            m_transport->close();
+            m_state = eNotConnected;
+            StateMachine();
+            return;
+          }
+          m_state = eReceiverInit;
           StateMachine();
-          return;
-        }
-        m_state = eReceiverInit;
-        StateMachine();
-      });
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::StateMachine() after async_connect() " << m_socket.is_open() << std::endl;
-#endif
+        });
+      }
       break;
     case eReceiverInit:
       if (m_connectedCb) m_connectedCb();
@@ -187,54 +298,43 @@ std::clog << "ConnectionHandler::StateMachine() after async_connect() " << m_soc
 #ifndef NDEBUG
 std::clog << "ConnectionHandler::StateMachine() read buffer size = " << m_connection->maxFrame() << std::endl;
 #endif
-        m_readReq = true;
-        m_socket.async_read_some(
-          m_inBuf->prepare(m_connection->maxFrame()),
-          boost::bind(&ConnectionHandler::onRead, this,
-                      boost::asio::placeholders::error,
-                      boost::asio::placeholders::bytes_transferred)
-        );
+        receive();
 #ifndef NDEBUG
-std::clog << "ConnectionHandler::StateMachine() read callback installed, bytes in input " << m_inBuf->size() << std::endl;
+std::clog << "ConnectionHandler::StateMachine() read callback installed, bytes in input " << m_inBuf.size() << std::endl;
 #endif
       }
       break;
     case eShutdown:
       {
-        boost::system::error_code ec;
-        boost::asio::ip::tcp::endpoint endpoint = m_socket.remote_endpoint(ec);
-        UNUSED(endpoint)
-        try
-        {
-          // if connection close by other side, the underlying descriptor
-          // already closed
-          if (!ec)
-            m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-        }
-        catch (boost::system::system_error& e)
-        {
-          // socket already dead
-        }
-        // waiting for asynchronous handlers complete
-        while (m_readReq || m_writeReq) m_service.run_one();
-        try
-        {
-          if (!ec) m_socket.close();
-        }
-        catch (boost::system::system_error& e)
-        {
-          // ignore error
-        }
-        // clear i/o buffers
-        auto buf(std::make_shared<boost::asio::streambuf>());
-        m_inBuf.swap(buf);
+        // if connection close by other side, the underlying descriptor
+        // already closed, errors are ignored
+        // closing cancels outstanding operations
+        m_transport->close();
+        m_lingerTimer.cancel();
+        m_heartbeatTimer.cancel();
+        // shutdown is finished by the last completed asynchronous handler,
+        // the event loop is never run from here
+        if (m_readReq || m_writeReq || m_lingerReq || m_heartbeatReq ||
+            m_connectReq)
+          break;
+        // clear i/o buffers; the input memory is kept, AMQP-CPP may still
+        // parse it if the connection was closed from inside parse()
+        m_inBuf.clear();
       }
-      while (!m_outBufs.empty()) m_outBufs.pop();
+      while (m_outHead < m_outBufs.size()) popFrame();
+      updateQueueStats();
+      m_sendCount = 0;
+      m_pendingBytes = 0;
+      m_corked = false;
+      m_congested = false;
       m_connection = nullptr;
+      // nothing is pending, the callbacks no longer hold the instance
+      m_transport->releaseCallbacks();
       m_state = eNotConnected;
       StateMachine();
       break;
     case eNotConnected:
+      AMQPASIO_TRACE_INFO(eShutdown, this, m_connectionLost, 0);
       if (m_shutdownCb) m_shutdownCb(m_lastError);
       m_lastError.clear();
       m_sentinel.reset();
@@ -248,98 +348,232 @@ void ConnectionHandler::onRead(const boost::system::error_code& ec,
                                std::size_t bytes)
 {
   m_readReq = false;
+  if (m_state == eShutdown)
+  {
+    // finish shutdown
+    StateMachine();
+    return;
+  }
   if (!connected()) return;
   if (ec)
   {
-    if (m_state != eShutdown)
-    {
-      m_lastError = "read error: ";
-      m_lastError.append(ec.message());
-      m_state = eShutdown;
-      StateMachine();
-    }
+    m_lastError = "read error: ";
+    m_lastError.append(ec.message());
+    m_connectionLost = true;
+    m_state = eShutdown;
+    StateMachine();
     return;
   }
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onRead() received " << bytes << std::endl;
-#endif
-  m_inBuf->commit(bytes);
+  m_inBuf.commit(bytes);
+  AMQPASIO_TRACE_DEBUG(eRead, this, bytes, m_inBuf.size());
+  if (m_options.wireCapture)
+    m_options.wireCapture->record(m_captureId,
+                                  m_inBuf.data() + m_inBuf.size() - bytes,
+                                  bytes);
+  m_lastRead = std::chrono::steady_clock::now();
+  ConnectionCounters::Add(m_counters->bytesIn, bytes);
+  ConnectionCounters::Add(m_counters->reads);
+  adaptReadSize(bytes);
   // Advanced Message Queuing Protocol Specification v0-9-1:
   // "The client opens a TCP/IP connection to the server and sends a protocol
   // header."
   // Thus, onData() called firstly, and m_connection will be filled.
-  if (m_inBuf->size() >= m_connection->expected())
+  if (m_inBuf.size() >= m_connection->expected())
   {
     uint64_t parsed = 0;
     do
     {
-      std::string buf;
-      buf.assign(boost::asio::buffers_begin(m_inBuf->data()),
-                 boost::asio::buffers_begin(m_inBuf->data()) + m_inBuf->size());
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onRead() in buf " << buf.size() << std::endl;
-#endif
-      parsed = m_connection->parse(buf.data(), buf.size());
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onRead() parsed " << parsed << std::endl;
-#endif
-      // If broker unexpectedly close connection, this object already cleared.
-      if (!connected()) return;
-      m_inBuf->consume(parsed);
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onRead() remain " << m_inBuf->size() << std::endl;
-#endif
-    } while ((m_inBuf->size() >= m_connection->expected()) && parsed);
+      // the buffer is contiguous, so AMQP-CPP parses it in place
+      const char* data = m_inBuf.data();
+      parsed = m_connection->parse(data, m_inBuf.size());
+      ConnectionCounters::Add(m_counters->parseCalls);
+      ConnectionCounters::Add(m_counters->framesIn, CountFrames(data, parsed));
+      AMQPASIO_TRACE_DEBUG(eParse, this, parsed, m_inBuf.size() - parsed);
+      // If broker unexpectedly close connection, this object already cleared
+      // or waits for other handlers to complete shutdown.
+      if (m_state != eReady) return;
+      m_inBuf.consume(parsed);
+    } while ((m_inBuf.size() >= m_connection->expected()) && parsed);
   }
+  receive();
+}
+
+void ConnectionHandler::receive()
+{
   m_readReq = true;
-  m_socket.async_read_some(
-    m_inBuf->prepare(m_connection->maxFrame()),
-    boost::bind(&ConnectionHandler::onRead, this,
-                boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred)
-  );
+  std::size_t size = m_readSize;
+  // the rest of a partial frame is requested at once
+  if (m_inBuf.size() < m_connection->expected())
+    size = std::max(size, std::min<std::size_t>(
+      m_connection->expected() - m_inBuf.size(), maxReadSize()
+    ));
+  // the block is reduced only between frames, never during parse()
+  if (!m_inBuf.size() && (m_inBuf.capacity() > 2 * size))
+    m_inBuf.shrink(2 * size);
+  m_requested = size;
+  auto buffer = m_inBuf.prepare(size);
+  // the block is replaced by a bigger or a smaller one
+  if (m_inBuf.capacity() != m_registered)
+  {
+    m_transport->registerBuffer(m_inBuf.storage());
+    m_registered = m_inBuf.capacity();
+  }
+  m_transport->read(buffer);
+}
+
+void ConnectionHandler::adaptReadSize(std::size_t bytes)
+{
+  if (bytes >= m_requested)
+  {
+    // the traffic is heavier than the read, multi-frame reads are welcome
+    m_smallReads = 0;
+    m_readSize = std::max(m_readSize, std::min(2 * m_readSize, maxReadSize()));
+    return;
+  }
+  if (2 * bytes >= m_readSize)
+  {
+    m_smallReads = 0;
+    return;
+  }
+  // a single short read may be a split segment, two in a row mean light
+  // traffic or idle connection (heartbeats only)
+  if (++m_smallReads < 2) return;
+  m_smallReads = 0;
+  std::size_t size = std::max<std::size_t>(m_options.receiveBufferMin, 1);
+  while (size < 2 * bytes) size *= 2;
+  if (size < m_readSize) m_readSize = size;
+  AMQPASIO_TRACE_DEBUG(eReadSize, this, m_readSize, bytes);
+}
+
+std::size_t ConnectionHandler::maxReadSize() const
+{
+  std::size_t size = m_options.receiveBufferMax ? m_options.receiveBufferMax
+                                                : 4 * m_connection->maxFrame();
+  return std::max(size, m_options.receiveBufferMin);
 }
 
 void ConnectionHandler::onWrite(const boost::system::error_code& ec,
                                 std::size_t bytes)
 {
-  UNUSED(bytes)
   m_writeReq = false;
+  if (m_state == eShutdown)
+  {
+    // finish shutdown
+    StateMachine();
+    return;
+  }
   if (!connected()) return;
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onWrite() send " << bytes << std::endl;
-std::clog << "ConnectionHandler::onWrite() " << uint64_t(m_outBufs.front().get()) << " remain " << m_outBufs.front()->size() << std::endl;
-#endif
   if (ec)
   {
-    if (m_state != eShutdown)
-    {
-      m_lastError = "write error: ";
-      m_lastError.append(ec.message());
-      m_state = eShutdown;
-      StateMachine();
-    }
+    m_lastError = "write error: ";
+    m_lastError.append(ec.message());
+    m_connectionLost = true;
+    m_state = eShutdown;
+    StateMachine();
     return;
   }
-  if (!m_outBufs.front()->size())
+  AMQPASIO_TRACE_DEBUG(eWrite, this, bytes, m_sendCount);
+  ConnectionCounters::Add(m_counters->bytesOut, bytes);
+  // the batch is written completely, give its memory back to the pool
+  for (; m_sendCount; --m_sendCount) popFrame();
+  updateQueueStats();
+  flush();
+  if (m_congested && (m_outBytes <= m_options.lowWatermark))
   {
-#ifndef NDEBUG
-std::clog << "ConnectionHandler::onWrite() drop " << uint64_t(m_outBufs.front().get()) << std::endl;
-#endif
-    m_outBufs.pop();
+    m_congested = false;
+    if (m_writableCb) m_writableCb(true);
   }
-  if (!m_outBufs.empty())
+}
+
+void ConnectionHandler::flush()
+{
+  if (m_writeReq || m_corked || (m_outHead == m_outBufs.size())) return;
+  if (m_lingerReq) m_lingerTimer.cancel();
+  // gather as many queued frames as the batch limit allows, but at least one
+  std::size_t bytes = 0, i = m_outHead;
+  m_gather.clear();
+  for (; i < m_outBufs.size(); ++i)
+  {
+    const FrameBuffer& frame = m_outBufs[i];
+    if (m_options.maxBatchBytes && (i > m_outHead) &&
+        (bytes + frame.size > m_options.maxBatchBytes))
+      break;
+    m_gather.push_back(boost::asio::buffer(frame.data, frame.size));
+    bytes += frame.size;
+  }
+  m_sendCount = i - m_outHead;
+  m_pendingBytes -= bytes;
+  AMQPASIO_TRACE_DEBUG(eFlush, this, m_sendCount, bytes);
+  m_writeReq = true;
+  m_lastWrite = std::chrono::steady_clock::now();
+  ConnectionCounters::Add(m_counters->writes);
+  m_transport->write(m_gather);
+}
+
+void ConnectionHandler::popFrame()
+{
+  m_outBytes -= m_outBufs[m_outHead].size;
+  m_framePool.release(m_outBufs[m_outHead]);
+  ++m_outHead;
+  if (m_outHead == m_outBufs.size())
+    {
+      m_outBufs.clear();
+      m_outHead = 0;
+    }
+    else if (m_outHead > m_outBufs.size() / 2)
+    {
+      // compact the queue without giving back its memory
+      m_outBufs.erase(m_outBufs.begin(), m_outBufs.begin() + m_outHead);
+      m_outHead = 0;
+    }
+}
+
+void ConnectionHandler::updateQueueStats()
+{
+  ConnectionCounters::Set(m_counters->outQueueFrames,
+                          m_counters->outQueueFramesPeak,
+                          m_outBufs.size() - m_outHead);
+  ConnectionCounters::Set(m_counters->outQueueBytes,
+                          m_counters->outQueueBytesPeak, m_outBytes);
+}
+
+void ConnectionHandler::scheduleHeartbeat()
+{
+  m_heartbeatReq = true;
+  // check twice per interval
+  m_heartbeatTimer.expires_from_now(std::chrono::milliseconds(m_heartbeat * 500));
+  m_heartbeatTimer.async_wait(
+    m_strand.wrap(boost::bind(&ConnectionHandler::onHeartbeatTimer,
+                              shared_from_this(),
+                              boost::asio::placeholders::error))
+  );
+}
+
+void ConnectionHandler::onHeartbeatTimer(const boost::system::error_code& ec)
+{
+  m_heartbeatReq = false;
+  if (m_state == eShutdown)
+  {
+    // finish shutdown
+    StateMachine();
+    return;
+  }
+  if ((ec == boost::asio::error::operation_aborted) || (m_state != eReady))
+    return;
+  auto now = std::chrono::steady_clock::now();
+  if (now - m_lastRead >= std::chrono::seconds(m_heartbeat * m_options.heartbeatMisses))
   {
 #ifndef NDEBUG
-std::clog << "ConnectionHandler::onWrite() wait for write " << m_outBufs.size() << std::endl;
-std::clog << "ConnectionHandler::onWrite() " << uint64_t(m_outBufs.front().get()) << " size = " << m_outBufs.front()->size() << std::endl;
+std::clog << "ConnectionHandler::onHeartbeatTimer() broker is silent" << std::endl;
 #endif
-    m_writeReq = true;
-    boost::asio::async_write(
-      m_socket, *m_outBufs.front().get(),
-      boost::bind(&ConnectionHandler::onWrite, this,
-                  boost::asio::placeholders::error,
-                  boost::asio::placeholders::bytes_transferred)
-    );
+    m_lastError = "heartbeat timeout";
+    m_connectionLost = true;
+    m_state = eShutdown;
+    StateMachine();
+    return;
   }
+  // idle for half an interval: the broker must hear from us
+  if (now - m_lastWrite >= std::chrono::milliseconds(m_heartbeat * 500))
+    m_connection->heartbeat();
+  scheduleHeartbeat();
 }
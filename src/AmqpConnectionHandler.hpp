@@ -1,13 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
-#include <queue>
 #include <memory>
 #include <string>
+#include <vector>
 #include <boost/asio/io_service.hpp>
-#include <boost/asio/ip/tcp.hpp>
-#include <boost/asio/streambuf.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <amqpcpp.h>
+#include "AmqpConnectionOptions.hpp"
+#include "AmqpConnectionStats.hpp"
+#include "AmqpFramePool.hpp"
+#include "AmqpReceiveBuffer.hpp"
+#include "AmqpTransport.hpp"
 
 namespace amqp {
 
@@ -18,14 +25,40 @@ namespace amqp {
 /// предоставляемую извне реализацию класса AMQP::ConnectionHandler. Данный
 /// класс является такой реализацией на базе библиотеки boost::asio.
 ///
-/// ConnectionHandler устанавливает и сопровождает TCP-соединение с брокером
-/// AMQP. Все операции ввода-вывода производятся асинхронно. Класс не является
-/// потокобезопасным.
+/// ConnectionHandler устанавливает и сопровождает соединение с брокером
+/// AMQP. Сам поток байтов предоставляет транспорт, заданный в конструкторе
+/// (см. Transport): TCP, в том числе с TLS, сокет домена Unix или обмен в
+/// памяти процесса. Все операции ввода-вывода производятся асинхронно. Обработчики их
+/// завершения выполняются через strand, заданный в конструкторе, поэтому
+/// цикл службы ввода/вывода может работать в нескольких потоках. Открытые
+/// методы класса не являются потокобезопасными и должны вызываться в
+/// контексте того же strand.
 ///
-/// Входящие данные накапливаются в общем буфере, откуда в методе onRead()
-/// передаются на обработку AMQP-CPP. Исходящие данные, напротив, помещаются в
+/// Экземпляры класса создаются только через std::shared_ptr: каждая
+/// незавершенная асинхронная операция удерживает экземпляр.
+///
+/// Входящие данные накапливаются в общем непрерывном буфере (см.
+/// ReceiveBuffer), который в методе onRead() разбирается AMQP-CPP на месте,
+/// без копирования. Исходящие данные, напротив, помещаются в
 /// очередь в виде отдельных буферов. Очередной буфер на отправку добавляется
-/// каждым вызовом onData(). При закрытии соединения все буфера сбрасываются.
+/// каждым вызовом onData(). Память буферов берется из пула FramePool и
+/// возвращается в него после отправки, так что при установившемся потоке
+/// исходящих кадров память не выделяется. При закрытии соединения все буфера
+/// сбрасываются.
+///
+/// Все накопленные в очереди буферы отправляются одной групповой операцией
+/// записи (writev). Кадры, поступившие во время записи, отправляются
+/// следующей группой. Параметры ConnectionOptions::writeLinger и
+/// ConnectionOptions::maxBatchBytes позволяют задержать начало записи для
+/// накопления группы и ограничить ее объем. Кроме того, отправку можно
+/// временно приостановить парой методов cork()/uncork().
+///
+/// Интервал heartbeat согласуется с брокером в onNegotiate() (см.
+/// ConnectionOptions::heartbeat). Пока соединение готово к работе, таймер
+/// проверяет его с периодом в половину интервала: если исходящих данных не
+/// было полинтервала, брокеру отправляется heartbeat, а если входящих данных
+/// нет ConnectionOptions::heartbeatMisses интервалов, соединение считается
+/// потерянным и закрывается, не дожидаясь таймаутов TCP.
 ///
 /// Экземпляры класса пригодны для повторного использования, т.е. пара методов
 /// start()/stop() может вызываться для одного экземпляра много раз.
@@ -34,46 +67,60 @@ namespace amqp {
 ///
 /// @startuml
 /// [*] -> eNotConnected
-/// eNotConnected -> eResolving : ConnectionHandler::start()
-/// eResolving -> eConnecting: Success
-/// eResolving -> eNotConnected : Fail
+/// eNotConnected -> eConnecting : ConnectionHandler::start()
 /// eConnecting --> eReceiverInit : Success
 /// eConnecting -> eNotConnected : Fail
 /// eReceiverInit --> eReady : First data in
 /// eReceiverInit --> eShutdown : Data read error
+/// eConnecting --> eShutdown : ConnectionHandler::stop()
 /// eReady --> eShutdown : ConnectionHandler::stop()
 /// eReady --> eShutdown : ConnectionHandler::onError()
 /// eReady --> eShutdown : ConnectionHandler::onClosed()
 /// eReady --> eShutdown : Data write error
+/// eReady --> eShutdown : Heartbeat timeout
 /// eShutdown --> [*]
 /// @enduml
 ///
 /// @author cycleg
 ///
-class ConnectionHandler: public AMQP::ConnectionHandler
+class ConnectionHandler: public AMQP::ConnectionHandler,
+                         public std::enable_shared_from_this<ConnectionHandler>
 {
   public:
     typedef std::function<void()>
       ConnectedCallback; ///< Указатель на функцию, вызываемую после
-                         ///< установления TCP-соединения с брокером.
+                         ///< установления соединения с брокером.
 
     typedef std::function<void(const std::string& message)>
       ShutdownCallback; ///< Указатель на функцию, вызываемую после завершения
                         ///< работы конечного автомата.
 
+    typedef std::function<void(bool writable)>
+      WritableCallback; ///< Указатель на функцию, вызываемую при смене
+                        ///< готовности соединения принимать исходящие
+                        ///< данные.
+
     ///
     /// Конструктор.
     ///
     /// @param [in] service
-    /// @param [in] host Имя или адрес хоста брокера AMQP.
-    /// @param [in] port TCP-порт брокера AMQP.
+    /// @param [in] strand Strand, через который выполняются обработчики
+    ///                    асинхронных операций.
+    /// @param [in] transport Транспорт соединения. Его обработчики должны
+    ///                       вызываться через тот же strand.
+    /// @param [in] options Параметры соединения.
     /// @param [in] shutdownCb Обратный вызов для закрытия соединения.
+    /// @param [in] counters Счетчики статистики (необязательный). Если не
+    ///                      заданы, обработчик заводит собственные.
     ///
     /// Обратный вызов выполняется после закрытия соединения с брокером.
     ///
     ConnectionHandler(boost::asio::io_service& service,
-                      const std::string& host, const std::string& port,
-                      ShutdownCallback shutdownCb);
+                      const boost::asio::io_service::strand& strand,
+                      std::shared_ptr<Transport> transport,
+                      const ConnectionOptions& options,
+                      ShutdownCallback shutdownCb,
+                      std::shared_ptr<ConnectionCounters> counters = nullptr);
     ///
     /// Деструктор.
     ///
@@ -109,11 +156,70 @@ class ConnectionHandler: public AMQP::ConnectionHandler
     /// Ошибка AMQP-CPP фиксируется, если был вызван метод onError().
     ///
     inline bool amqp_error() const { return m_amqpError; }
+    ///
+    /// Соединение потеряно.
+    ///
+    /// @return Возвращает true, если соединение закрыто из-за ошибки
+    ///         ввода/вывода или отсутствия heartbeat от брокера.
+    ///
+    inline bool connection_lost() const { return m_connectionLost; }
+    ///
+    /// Согласованный с брокером интервал heartbeat.
+    ///
+    /// @return Интервал в секундах, нуль -- heartbeat не используется.
+    ///
+    inline uint16_t heartbeat() const { return m_heartbeat; }
+    ///
+    /// Объем копирования в буфере входящих данных.
+    ///
+    /// @return Число байтов незавершенных кадров, перенесенных внутри буфера
+    ///         входящих данных за все время работы обработчика.
+    ///
+    inline uint64_t input_copied() const { return m_inBuf.copied(); }
+    ///
+    /// Объем очередного приема.
+    ///
+    /// @return Число байтов, которое будет запрошено следующим приемом.
+    ///
+    inline std::size_t read_size() const { return m_readSize; }
+    ///
+    /// Счетчики статистики ввода/вывода.
+    ///
+    /// @return Ссылка на счетчики. Читать их можно из любого потока.
+    ///
+    inline const ConnectionCounters& counters() const { return *m_counters; }
+    ///
+    /// Объем исходящих данных в очереди.
+    ///
+    /// @return Число байтов, ожидающих отправки или отправляемых.
+    ///
+    inline std::size_t outbound_bytes() const { return m_outBytes; }
+    ///
+    /// Готовность соединения принимать исходящие данные.
+    ///
+    /// @return Готово или нет.
+    ///
+    /// Соединение не готово, если объем очереди исходящих данных достиг
+    /// ConnectionOptions::highWatermark, и снова готово, когда очередь
+    /// опустошится до ConnectionOptions::lowWatermark. Готовность не
+    /// мешает AMQP-CPP помещать данные в очередь, это лишь сигнал
+    /// вышестоящим уровням.
+    ///
+    inline bool writable() const { return !m_congested; }
+
+    ///
+    /// Назначить обратный вызов для смены готовности принимать исходящие
+    /// данные.
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    inline void onWritable(WritableCallback callback)
+    { m_writableCb = callback; }
 
     ///
     /// Запустить (открыть) соединение с брокером AMQP.
     ///
-    /// @param [in] callback Обратный вызов при установлении TCP-соединения.
+    /// @param [in] callback Обратный вызов при установлении соединения.
     ///
     /// Если соединение не остановлено, не делает ничего. Соединение
     /// устанавливается асинхронно.
@@ -123,13 +229,46 @@ class ConnectionHandler: public AMQP::ConnectionHandler
     /// Остановить (закрыть) соединение с брокером.
     ///
     /// Если соединение уже разорвано, не делает ничего. Соединение
-    /// разрывается синхронно.
+    /// разрывается асинхронно: сокет закрывается сразу, а после завершения
+    /// всех начатых операций ввода/вывода выполняется обратный вызов,
+    /// заданный в конструкторе.
     ///
     void stop();
+    ///
+    /// Отключить все обратные вызовы.
+    ///
+    /// Используется владельцем, который уничтожается раньше, чем завершатся
+    /// асинхронные операции экземпляра.
+    ///
+    void detach();
 
-#if 0
+    ///
+    /// Приостановить отправку исходящих данных.
+    ///
+    /// Исходящие кадры накапливаются в очереди до вызова uncork(). Запись,
+    /// начатая ранее, не прерывается.
+    ///
+    void cork();
+    ///
+    /// Возобновить отправку исходящих данных.
+    ///
+    /// Накопленные кадры отправляются немедленно, без учета
+    /// ConnectionOptions::writeLinger.
+    ///
+    void uncork();
+
+    ///
+    /// Вызывается AMQP-CPP для согласования интервала heartbeat.
+    ///
+    /// @param [in] connection Указатель на класс соединения с брокером AMQP.
+    /// @param [in] interval Интервал (с), предложенный брокером.
+    /// @return Интервал, принятый клиентом.
+    ///
+    /// Если интервал ненулевой, запускается таймер heartbeat.
+    ///
+    /// Реализация AMQP::ConnectionHandler::onNegotiate().
+    ///
     uint16_t onNegotiate(AMQP::Connection* connection, uint16_t interval) override;
-#endif
 
     ///
     /// Вызывается для отправки данных из AMQP-CPP.
@@ -168,8 +307,7 @@ class ConnectionHandler: public AMQP::ConnectionHandler
     enum State
     {
       eNotConnected, ///< Соединение отсутствует.
-      eResolving, ///< Разрешается DNS-имя брокера AMQP.
-      eConnecting, ///< Устанавливается TCP-соединение с брокером.
+      eConnecting, ///< Транспорт подключается к брокеру.
       eReceiverInit, ///< Ожидается начальный отклик брокера (запрос посылает
                      ///< AMQP-CPP).
       eReady, ///< Соединение готово к работе.
@@ -177,7 +315,7 @@ class ConnectionHandler: public AMQP::ConnectionHandler
     };
 
     ///
-    /// Установлено TCP-соединение с брокером AMQP или нет.
+    /// Установлено соединение с брокером AMQP или нет.
     ///
     /// @return Вовзращает true, если ожидается начальный отклик или соединение
     ///         готово к работе.
@@ -201,6 +339,28 @@ class ConnectionHandler: public AMQP::ConnectionHandler
     ///
     void onRead(const boost::system::error_code& ec, std::size_t bytes);
     ///
+    /// Начать очередной асинхронный прием.
+    ///
+    void receive();
+    ///
+    /// Подстроить объем приема под входящий трафик.
+    ///
+    /// @param [in] bytes Число байтов, принятых последним приемом.
+    ///
+    /// Если прием заполнил запрошенный объем, объем следующего удваивается
+    /// (до ConnectionOptions::receiveBufferMax). Если два приема подряд
+    /// приняли меньше половины, объем уменьшается до наименьшей степени
+    /// двойки от ConnectionOptions::receiveBufferMin, вдвое большей
+    /// принятого.
+    ///
+    void adaptReadSize(std::size_t bytes);
+    ///
+    /// Верхняя граница объема приема.
+    ///
+    /// @return Число байтов.
+    ///
+    std::size_t maxReadSize() const;
+    ///
     /// Обратный вызов при завершении очередной асинхронной передачи.
     ///
     /// @param [in] ec Код завершения асинхронной операции.
@@ -209,31 +369,95 @@ class ConnectionHandler: public AMQP::ConnectionHandler
     /// Вызывается из boost::asio.
     ///
     void onWrite(const boost::system::error_code& ec, std::size_t bytes);
+    ///
+    /// Запустить очередной период таймера heartbeat.
+    ///
+    void scheduleHeartbeat();
+    ///
+    /// Обратный вызов по истечении периода таймера heartbeat.
+    ///
+    /// @param [in] ec Код завершения асинхронной операции.
+    ///
+    /// Отправляет heartbeat, если соединение простаивает, и закрывает его,
+    /// если от брокера давно нет данных.
+    ///
+    void onHeartbeatTimer(const boost::system::error_code& ec);
+    ///
+    /// Начать групповую запись накопленных исходящих кадров.
+    ///
+    /// Если запись уже идет, отправка приостановлена или очередь пуста, не
+    /// делает ничего.
+    ///
+    void flush();
+    ///
+    /// Удалить первый буфер из очереди исходящих данных.
+    ///
+    /// Память буфера возвращается в пул.
+    ///
+    void popFrame();
+    ///
+    /// Обновить в статистике глубину очереди исходящих данных.
+    ///
+    void updateQueueStats();
 
     boost::asio::io_service& m_service; ///< Экземпляр службы ввода/вывода
                                         ///< ASIO, через который проходят
                                         ///< данные.
-    boost::asio::ip::tcp::socket m_socket; ///< Сокет соединения с брокером AMQP.
+    boost::asio::io_service::strand m_strand; ///< Strand соединения.
+    std::shared_ptr<Transport> m_transport; ///< Транспорт соединения с
+                                            ///< брокером AMQP.
     std::shared_ptr<boost::asio::io_service::work>
       m_sentinel; ///< "Сторож", не дает циклу службы ввода/вывода, заданной в
                   ///< конструкторе, завершиться раньше времени.
-    std::shared_ptr<boost::asio::streambuf> m_inBuf; ///< Буфер входящих данных.
-    std::queue< std::shared_ptr<boost::asio::streambuf> >
-      m_outBufs; ///< Очередь буферов исходящих данных.
-    std::string m_host, ///< Имя или адрес хоста брокера.
-                m_port, ///< TCP-порт брокера.
-                m_lastError; ///< Описание последней ошибки, возникшей в
+    ReceiveBuffer m_inBuf; ///< Буфер входящих данных.
+    std::size_t m_registered, ///< Размер блока памяти m_inBuf,
+                              ///< зарегистрированного в транспорте.
+                m_readSize, ///< Объем очередного приема, подстраивается
+                            ///< под входящий трафик.
+                m_requested; ///< Объем, запрошенный последним приемом.
+    unsigned m_smallReads; ///< Число подряд идущих приемов меньше половины
+                           ///< m_readSize.
+    uint32_t m_captureId; ///< Номер соединения в ConnectionOptions::wireCapture.
+    ConnectionOptions m_options; ///< Параметры соединения.
+    FramePool m_framePool; ///< Пул буферов исходящих данных.
+    std::vector<FrameBuffer> m_outBufs; ///< Очередь буферов исходящих данных.
+    std::size_t m_outHead, ///< Индекс первого буфера в очереди.
+                m_sendCount, ///< Число буферов в передаваемой группе.
+                m_pendingBytes; ///< Объем данных в очереди, ожидающих
+                                ///< передачи.
+    std::atomic<std::size_t> m_outBytes; ///< Общий объем данных в очереди.
+                                         ///< Может читаться из других
+                                         ///< потоков.
+    std::vector<boost::asio::const_buffer>
+      m_gather; ///< Передаваемая группа буферов.
+    boost::asio::steady_timer m_lingerTimer; ///< Таймер задержки отправки.
+    boost::asio::steady_timer m_heartbeatTimer; ///< Таймер heartbeat.
+    std::chrono::steady_clock::time_point m_lastRead, ///< Время последнего
+                                                      ///< приема данных.
+                                          m_lastWrite; ///< Время последней
+                                                       ///< отправки данных.
+    uint16_t m_heartbeat; ///< Согласованный интервал heartbeat (с).
+    std::string m_lastError; ///< Описание последней ошибки, возникшей в
                              ///< работе соединения с брокером.
     AMQP::Connection* m_connection; ///< Соединение с брокером на стороне AMQP-CPP.
     State m_state; ///< Текущее состояние соединения.
-    boost::asio::ip::tcp::resolver m_resolver;
-    boost::asio::ip::tcp::resolver::iterator m_rIterator;
     ConnectedCallback m_connectedCb; ///< Обратный вызов после установления
-                                     ///< TCP-соединения с брокером.
+                                     ///< соединения с брокером.
     ShutdownCallback m_shutdownCb; ///< Обратный вызов после закрытия соединения.
+    WritableCallback m_writableCb; ///< Обратный вызов при смене готовности
+                                   ///< принимать исходящие данные.
     bool m_amqpError, ///< Признак, что AMQP-CPP был вызан обработчик onError().
          m_readReq, ///< Признак, что запущена асинхронная операция приема из сокета.
-         m_writeReq; ///< Признак, что запущена асинхронная операция отправки в сокет.
+         m_writeReq, ///< Признак, что запущена асинхронная операция отправки в сокет.
+         m_lingerReq, ///< Признак, что запущен таймер задержки отправки.
+         m_heartbeatReq, ///< Признак, что запущен таймер heartbeat.
+         m_connectReq, ///< Признак, что транспорт подключается.
+         m_connectionLost, ///< Признак, что соединение потеряно.
+         m_corked, ///< Признак, что отправка приостановлена.
+         m_congested; ///< Признак, что объем очереди исходящих данных
+                      ///< превысил верхнюю границу.
+    std::shared_ptr<ConnectionCounters> m_counters; ///< Счетчики
+                                                    ///< статистики.
 };
 
 } // namespace amqp
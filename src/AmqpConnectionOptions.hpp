@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "AmqpResolverCache.hpp"
+#include "AmqpTransport.hpp"
+#include "AmqpWireCapture.hpp"
+
+namespace amqp {
+
+///
+/// Параметры соединения с брокером AMQP.
+
+/// Параметры задаются при создании amqp::Connector и передаются каждому
+/// создаваемому им экземпляру amqp::ConnectionHandler. Значения по умолчанию
+/// соответствуют поведению, при котором исходящие данные отправляются
+/// немедленно.
+///
+/// @author cycleg
+///
+struct ConnectionOptions
+{
+  unsigned writeLinger = 0; ///< Время (мкс), в течение которого исходящие
+                            ///< кадры накапливаются перед отправкой, если
+                            ///< передача не идет. Нуль -- отправлять сразу.
+  std::size_t maxBatchBytes = 0; ///< Максимальный объем (байт) одной
+                                 ///< групповой передачи. Нуль -- без
+                                 ///< ограничений. Кадр больше предела
+                                 ///< передается отдельно.
+  std::size_t highWatermark = 0; ///< Объем (байт) очереди исходящих данных,
+                                 ///< при достижении которого соединение
+                                 ///< перестает принимать данные на отправку.
+                                 ///< Нуль -- без ограничений.
+  std::size_t lowWatermark = 0; ///< Объем (байт) очереди исходящих данных,
+                                ///< при снижении до которого соединение
+                                ///< снова принимает данные на отправку.
+  bool refuseAboveHighWatermark = false; ///< Отказывать в публикации
+                                         ///< сообщений, пока объем очереди
+                                         ///< исходящих данных выше
+                                         ///< highWatermark.
+  std::size_t receiveBufferMin = 4096; ///< Наименьший объем (байт) одного
+                                       ///< приема. С него начинается прием
+                                       ///< в новом соединении, до него
+                                       ///< уменьшается прием в простаивающем.
+  std::size_t receiveBufferMax = 0; ///< Наибольший объем (байт) одного
+                                    ///< приема, при интенсивном трафике
+                                    ///< прием растет до него. Память
+                                    ///< буфера входящих данных ограничена
+                                    ///< примерно двумя такими объемами.
+                                    ///< Нуль -- четыре кадра frame_max.
+  unsigned heartbeat = 60; ///< Интервал (с) heartbeat, предлагаемый брокеру.
+                           ///< Используется меньший из этого и предложенного
+                           ///< брокером. Нуль -- heartbeat не используется.
+  unsigned heartbeatMisses = 2; ///< Число интервалов heartbeat без входящих
+                                ///< данных, после которого брокер считается
+                                ///< недоступным, а соединение -- потерянным.
+                                ///< Тишина проверяется дважды за интервал,
+                                ///< поэтому потеря обнаруживается через
+                                ///< heartbeat * heartbeatMisses --
+                                ///< heartbeat * (heartbeatMisses + 0.5) с:
+                                ///< по умолчанию через 120--150 с. Для
+                                ///< быстрого переключения интервал нужно
+                                ///< уменьшить, например, heartbeat = 5
+                                ///< дает 10--12,5 с.
+  bool tlsVerifyPeer = true; ///< Проверять сертификат брокера и имя хоста в
+                             ///< нем (только amqps://).
+  std::string tlsCaFile; ///< Файл корневых сертификатов (PEM). Пустая
+                         ///< строка -- системное хранилище.
+  std::string tlsCertFile; ///< Файл цепочки сертификатов клиента (PEM),
+                           ///< необязательный.
+  std::string tlsKeyFile; ///< Файл закрытого ключа клиента (PEM),
+                          ///< необязательный.
+  std::shared_ptr<ResolverCache> resolverCache; ///< Кэш разрешения имен.
+                                               ///< Если не задан,
+                                               ///< используется общий кэш
+                                               ///< процесса.
+  unsigned dnsTtl = 60; ///< Время жизни (с) адресов брокера в кэше.
+                        ///< Нуль -- имя разрешается при каждом
+                        ///< подключении.
+  unsigned connectStagger = 250; ///< Пауза (мс), после которой, если
+                                 ///< подключение к очередному адресу брокера
+                                 ///< не завершено, параллельно начинается
+                                 ///< подключение к следующему.
+  TransportFactory transportFactory = nullptr; ///< Фабрика транспорта
+                                               ///< соединения. Если не
+                                               ///< задана, транспорт
+                                               ///< выбирается по URL брокера:
+                                               ///< TCP (amqp://, amqps://)
+                                               ///< или сокет домена Unix
+                                               ///< (amqp+unix://).
+  std::shared_ptr<WireCapture> wireCapture; ///< Запись принятых от брокера
+                                            ///< байтов для воспроизведения
+                                            ///< (amqp-replay). Если не
+                                            ///< задана, запись не ведется.
+};
+
+} // namespace amqp
@@ -0,0 +1,44 @@
+#include "AmqpConnectionStats.hpp"
+
+using namespace amqp;
+
+ConnectionStats& ConnectionStats::operator+=(const ConnectionStats& other)
+{
+  bytesIn += other.bytesIn;
+  reads += other.reads;
+  bytesOut += other.bytesOut;
+  writes += other.writes;
+  framesIn += other.framesIn;
+  framesOut += other.framesOut;
+  parseCalls += other.parseCalls;
+  connects += other.connects;
+  reconnects += other.reconnects;
+  outQueueFrames += other.outQueueFrames;
+  outQueueFramesPeak += other.outQueueFramesPeak;
+  outQueueBytes += other.outQueueBytes;
+  outQueueBytesPeak += other.outQueueBytesPeak;
+  published += other.published;
+  received += other.received;
+  return *this;
+}
+
+ConnectionStats ConnectionCounters::snapshot() const
+{
+  ConnectionStats stats;
+  stats.bytesIn = bytesIn.load(std::memory_order_relaxed);
+  stats.reads = reads.load(std::memory_order_relaxed);
+  stats.bytesOut = bytesOut.load(std::memory_order_relaxed);
+  stats.writes = writes.load(std::memory_order_relaxed);
+  stats.framesIn = framesIn.load(std::memory_order_relaxed);
+  stats.framesOut = framesOut.load(std::memory_order_relaxed);
+  stats.parseCalls = parseCalls.load(std::memory_order_relaxed);
+  stats.connects = connects.load(std::memory_order_relaxed);
+  stats.reconnects = stats.connects ? stats.connects - 1 : 0;
+  stats.outQueueFrames = outQueueFrames.load(std::memory_order_relaxed);
+  stats.outQueueFramesPeak = outQueueFramesPeak.load(std::memory_order_relaxed);
+  stats.outQueueBytes = outQueueBytes.load(std::memory_order_relaxed);
+  stats.outQueueBytesPeak = outQueueBytesPeak.load(std::memory_order_relaxed);
+  stats.published = published.load(std::memory_order_relaxed);
+  stats.received = received.load(std::memory_order_relaxed);
+  return stats;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace amqp {
+
+///
+/// Снимок статистики ввода/вывода соединения с брокером AMQP.
+
+/// Счетчики накапливаются за все время жизни amqp::Connector, в том числе
+/// через переподключения. Глубина очереди исходящих данных относится к
+/// текущему соединению, пиковые значения -- ко всему времени жизни.
+///
+/// @author cycleg
+///
+struct ConnectionStats
+{
+  uint64_t bytesIn = 0; ///< Принято байтов.
+  uint64_t reads = 0; ///< Завершено операций приема.
+  uint64_t bytesOut = 0; ///< Отправлено байтов.
+  uint64_t writes = 0; ///< Начато групповых передач.
+  uint64_t framesIn = 0; ///< Разобрано входящих кадров.
+  uint64_t framesOut = 0; ///< Поставлено в очередь исходящих кадров.
+  uint64_t parseCalls = 0; ///< Вызовов разбора входящих данных AMQP-CPP.
+  uint64_t connects = 0; ///< Установлено соединений.
+  uint64_t reconnects = 0; ///< Установлено соединений, кроме первого.
+  uint64_t outQueueFrames = 0; ///< Кадров в очереди исходящих данных.
+  uint64_t outQueueFramesPeak = 0; ///< Наибольшее число кадров в очереди.
+  uint64_t outQueueBytes = 0; ///< Байтов в очереди исходящих данных.
+  uint64_t outQueueBytesPeak = 0; ///< Наибольший объем очереди (байт).
+  uint64_t published = 0; ///< Опубликовано сообщений приемопередатчиками.
+  uint64_t received = 0; ///< Получено сообщений приемопередатчиками.
+
+  ///
+  /// Сложить статистику нескольких соединений.
+  ///
+  /// @param [in] other Статистика другого соединения.
+  /// @return Ссылка на данный экземпляр.
+  ///
+  /// Пиковые значения тоже складываются и дают оценку сверху.
+  ///
+  ConnectionStats& operator+=(const ConnectionStats& other);
+};
+
+///
+/// Счетчики статистики ввода/вывода соединения.
+
+/// Экземпляр принадлежит amqp::Connector и передается каждому его
+/// обработчику соединения и приемопередатчику. Счетчики изменяются только в
+/// strand коннектора, поэтому увеличиваются без атомарных
+/// read-modify-write операций (см. Add()), а читаются из любого потока
+/// через snapshot().
+///
+/// @author cycleg
+///
+struct ConnectionCounters
+{
+  typedef std::atomic<uint64_t> Counter; ///< Тип счетчика.
+
+  Counter bytesIn{0}; ///< См. ConnectionStats::bytesIn.
+  Counter reads{0}; ///< См. ConnectionStats::reads.
+  Counter bytesOut{0}; ///< См. ConnectionStats::bytesOut.
+  Counter writes{0}; ///< См. ConnectionStats::writes.
+  Counter framesIn{0}; ///< См. ConnectionStats::framesIn.
+  Counter framesOut{0}; ///< См. ConnectionStats::framesOut.
+  Counter parseCalls{0}; ///< См. ConnectionStats::parseCalls.
+  Counter connects{0}; ///< См. ConnectionStats::connects.
+  Counter outQueueFrames{0}; ///< См. ConnectionStats::outQueueFrames.
+  Counter outQueueFramesPeak{0}; ///< См. ConnectionStats::outQueueFramesPeak.
+  Counter outQueueBytes{0}; ///< См. ConnectionStats::outQueueBytes.
+  Counter outQueueBytesPeak{0}; ///< См. ConnectionStats::outQueueBytesPeak.
+  Counter published{0}; ///< См. ConnectionStats::published.
+  Counter received{0}; ///< См. ConnectionStats::received.
+
+  ///
+  /// Увеличить счетчик.
+  ///
+  /// @param [in] counter Счетчик.
+  /// @param [in] n Приращение.
+  ///
+  /// Писатель у счетчика один, поэтому достаточно пары relaxed-операций.
+  ///
+  static inline void Add(Counter& counter, uint64_t n = 1)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+  ///
+  /// Задать текущее значение и обновить пиковое.
+  ///
+  /// @param [in] gauge Текущее значение.
+  /// @param [in] peak Пиковое значение.
+  /// @param [in] value Новое значение.
+  ///
+  static inline void Set(Counter& gauge, Counter& peak, uint64_t value)
+  {
+    gauge.store(value, std::memory_order_relaxed);
+    if (value > peak.load(std::memory_order_relaxed))
+      peak.store(value, std::memory_order_relaxed);
+  }
+
+  ///
+  /// Снять значения счетчиков.
+  ///
+  /// @return Снимок статистики.
+  ///
+  ConnectionStats snapshot() const;
+};
+
+} // namespace amqp
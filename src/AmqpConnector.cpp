@@ -1,11 +1,13 @@
 #ifndef NDEBUG
 #include <iostream>
 #endif
-#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include "AmqpConnectionHandler.hpp"
 #include "AmqpConnector.hpp"
+#include "AmqpTcpTransport.hpp"
+#include "AmqpUnixTransport.hpp"
 
 using namespace amqp;
 
@@ -13,20 +15,49 @@ template class Connector<Transceiver>; // инстанциирование ша
 
 template <class TransceiverImpl>
 Connector<TransceiverImpl>::Connector(boost::asio::io_service& service,
-                                      std::string brokerUrl):
-  m_address(brokerUrl),
+                                      std::string brokerUrl,
+                                      const ConnectionOptions& options):
+  m_address(AmqpUrl(brokerUrl)),
+  m_options(options),
+  m_unixPath(UnixSocketPath(brokerUrl)),
   m_service(service),
+  m_strand(service),
   m_exiting(false),
   m_connectionHandlerReady(false),
+  m_starting(false),
   m_startedCb(nullptr),
-  m_exitCb(nullptr)
+  m_exitCb(nullptr),
+  m_drainCb(nullptr)
 {
+  if (m_address.secure()) m_tls = std::make_shared<TlsContext>(m_options);
+  if (!m_options.resolverCache) m_options.resolverCache = ResolverCache::Global();
+  m_counters = std::make_shared<ConnectionCounters>();
 }
 
 template <class TransceiverImpl>
 Connector<TransceiverImpl>::~Connector()
 {
-  stop();
+  // Regular asynchronous stop is impossible here, the connection handler
+  // completes its shutdown alone.
+  if (m_connectionHandler)
+  {
+    m_connectionHandler->detach();
+    m_connectionHandler->stop();
+  }
+  for (auto& i: m_transceivers) i->drop();
+}
+
+template <class TransceiverImpl>
+bool Connector<TransceiverImpl>::writable() const
+{
+  return m_connectionHandlerReady && m_connectionHandler->writable();
+}
+
+template <class TransceiverImpl>
+std::size_t Connector<TransceiverImpl>::outbound_bytes() const
+{
+  // the handler is replaced in the strand, the gauge outlives it
+  return std::size_t(m_counters->outQueueBytes.load(std::memory_order_relaxed));
 }
 
 template <class TransceiverImpl>
@@ -39,152 +70,218 @@ Connector<TransceiverImpl>::transceiver(const std::string& exchange,
   TransceiverPtr transceiver = std::make_shared<Transceiver>(
     exchange, queue_, route_in, listener
   );
-  // TODO: thread safety
+  transceiver->backpressure(m_options.refuseAboveHighWatermark);
+  transceiver->counters(m_counters.get());
+  transceiver->corking([this](bool cork) {
+    if (!m_connectionHandler) return;
+    if (cork) m_connectionHandler->cork();
+      else m_connectionHandler->uncork();
+  });
+  std::weak_ptr<TransceiverImpl> weak(transceiver);
+  // any thread may post, e.g. through an AckHandle
+  auto strand = std::make_shared<boost::asio::io_service::strand>(m_strand);
+  transceiver->poster([strand, weak](
+    std::function<void(Transceiver&)> task
+  ) {
+    // runs after the current handler, e.g. after all parsed deliveries
+    strand->post([weak, task]() {
+      if (auto trn = weak.lock()) task(*trn);
+    });
+  });
+  boost::asio::io_service* service = &m_service;
+  transceiver->scheduler([service, strand, weak](
+    std::chrono::microseconds delay, std::function<void(Transceiver&)> task
+  ) {
+    // the timer lives until its handler is done
+    auto timer = std::make_shared<boost::asio::steady_timer>(*service);
+    timer->expires_from_now(delay);
+    timer->async_wait(strand->wrap(
+      [timer, weak, task](const boost::system::error_code& ec) {
+        if (ec) return;
+        if (auto trn = weak.lock()) task(*trn);
+      }
+    ));
+  });
+  if (m_connectionHandler && !m_connectionHandler->writable())
+    transceiver->setWritable(false);
   m_transceivers.push_front(transceiver);
   return m_transceivers.begin();
 }
 
 template <class TransceiverImpl>
-void Connector<TransceiverImpl>::open(Connector<TransceiverImpl>::iterator i)
+void Connector<TransceiverImpl>::open(Connector<TransceiverImpl>::iterator i,
+                                      DoneCallback callback)
 {
-  // TODO: thread safety
-  TransceiverPtr t(*i);
-  if (!t->is_running() && ready())
-  {
-    t->start(m_amqpConnection.get());
-    while (t->is_running() && !t->ready()) m_service.run_one();
-  }
+  m_strand.dispatch([this, i, callback]() {
+    if (ready()) (*i)->start(m_amqpConnection.get(), callback);
+  });
 }
 
 template <class TransceiverImpl>
-void Connector<TransceiverImpl>::close(Connector<TransceiverImpl>::iterator i)
+void Connector<TransceiverImpl>::close(Connector<TransceiverImpl>::iterator i,
+                                       DoneCallback callback)
 {
-  // TODO: thread safety
-  TransceiverPtr t(*i);
-  if (t->is_running())
-  {
-    t->stop();
-    while (t->is_running()) m_service.run_one();
-  }
+  m_strand.dispatch([i, callback]() {
+    (*i)->stop(callback);
+  });
 }
 
 template <class TransceiverImpl>
 void Connector<TransceiverImpl>::remove(Connector<TransceiverImpl>::iterator i)
 {
-  // TODO: thread safety
   m_transceivers.erase(i);
 }
 
+template <class TransceiverImpl>
+void Connector<TransceiverImpl>::resolve()
+{
+  // only TCP transport resolves the broker name
+  if (m_options.transportFactory || !m_unixPath.empty()) return;
+  m_options.resolverCache->resolve(m_service, m_address.hostname(),
+    boost::lexical_cast<std::string>(m_address.port()), m_options.dnsTtl);
+}
+
 template <class TransceiverImpl>
 void Connector<TransceiverImpl>::async_start(StartedCallback callback)
 {
-  // TODO: thread safety
-  if (m_connectionHandlerReady) return;
-  m_exiting = false;
-  m_startedCb = callback;
-  {
-    auto work = std::make_shared< boost::asio::io_service::work >(m_service);
-    m_sentinel.swap(work);
-  }
-  auto connectionHandler = std::make_shared<ConnectionHandler>(
-    m_service,
-    m_address.hostname(),
-    boost::lexical_cast<std::string>(m_address.port()),
-    boost::bind(&Connector<TransceiverImpl>::onShutdown, this, _1)
-  );
-  m_connectionHandler.swap(connectionHandler);
-  m_connectionHandler->start(
-    boost::bind(&Connector<TransceiverImpl>::onConnected, this)
-  );
+  m_strand.dispatch([this, callback]() {
+    if (m_connectionHandlerReady) return;
+    m_exiting = false;
+    m_startedCb = callback;
+    {
+      auto work = std::make_shared< boost::asio::io_service::work >(m_service);
+      m_sentinel.swap(work);
+    }
+    std::shared_ptr<Transport> transport;
+    if (m_options.transportFactory)
+      transport = m_options.transportFactory(m_strand);
+      else if (!m_unixPath.empty())
+        transport = std::make_shared<UnixTransport>(m_service, m_strand,
+                                                    m_unixPath);
+      else
+        transport = std::make_shared<TcpTransport>(
+          m_service, m_strand, m_address.hostname(),
+          boost::lexical_cast<std::string>(m_address.port()), m_options,
+          m_tls
+        );
+    auto connectionHandler = std::make_shared<ConnectionHandler>(
+      m_service,
+      m_strand,
+      transport,
+      m_options,
+      boost::bind(&Connector<TransceiverImpl>::onShutdown, this, _1),
+      m_counters
+    );
+    m_connectionHandler.swap(connectionHandler);
+    m_connectionHandler->onWritable(
+      boost::bind(&Connector<TransceiverImpl>::onWritable, this, _1)
+    );
+    m_connectionHandler->start(
+      boost::bind(&Connector<TransceiverImpl>::onConnected, this)
+    );
+  });
 }
 
 template <class TransceiverImpl>
 void Connector<TransceiverImpl>::start()
 {
-  // TODO: thread safety
   if (m_connectionHandlerReady) return;
+  m_starting = true;
   async_start();
-  do
-  {
-    m_service.run_one();
-  } while (!m_connectionHandler->stopped() && !m_connectionHandler->ready());
+  while (m_starting) m_service.run_one();
 }
 
 template <class TransceiverImpl>
-void Connector<TransceiverImpl>::run()
+void Connector<TransceiverImpl>::run(DoneCallback callback)
 {
-  if (!m_connectionHandlerReady) return;
+  m_strand.dispatch([this, callback]() {
+    if (!m_connectionHandlerReady) return;
 #ifndef NDEBUG
 std::clog << "Connector::run()" << std::endl;
 #endif
-  {
-    auto work = std::make_shared< boost::asio::io_service::work >(m_service);
-    m_sentinel.swap(work);
-  }
-  for (auto& i: m_transceivers)
-    if (!i->is_running())
     {
-#ifndef NDEBUG
-std::clog << "Connector::run() " << i->route_in() << "@" << i->exchange_point() << std::endl;
-#endif
-      i->start(m_amqpConnection.get());
+      auto work = std::make_shared< boost::asio::io_service::work >(m_service);
+      m_sentinel.swap(work);
     }
-  for (auto& i: m_transceivers)
-  {
-    while (i->is_running() && !i->ready()) m_service.run_one();
-  }
+    // the callback is called after the last transceiver has started
+    auto pending = std::make_shared<std::size_t>(1);
+    auto done = [pending, callback]() {
+      if (--*pending) return;
+      if (callback) callback();
+    };
+    for (auto& i: m_transceivers)
+      if (!i->ready())
+      {
 #ifndef NDEBUG
-std::clog << "Connector::run() m_connectionHandlerReady = " << m_connectionHandlerReady << std::endl;
+std::clog << "Connector::run() " << i->route_in() << "@" << i->exchange_point() << std::endl;
 #endif
+        ++*pending;
+        i->start(m_amqpConnection.get(), done);
+      }
+    done();
+  });
 }
 
 template <class TransceiverImpl>
-void Connector<TransceiverImpl>::stop()
+void Connector<TransceiverImpl>::stop(DoneCallback callback)
 {
+  m_strand.dispatch([this, callback]() {
 #ifndef NDEBUG
 std::clog << "Connector::stop() " << m_connectionHandlerReady << std::endl;
 #endif
-  // TODO: thread safety
-  if (!m_connectionHandlerReady) return;
-  for (auto& i: m_transceivers)
-  {
-    i->stop();
-  }
-  m_service.post([this]() {
-    for (auto& i: m_transceivers)
+    if (!m_connectionHandlerReady &&
+        (!m_connectionHandler || m_connectionHandler->stopped()))
     {
-      while (i->is_running()) m_service.run_one();
+      // nothing to stop, the callback is never called from stop() itself
+      if (callback) m_strand.post(callback);
+      return;
     }
-    if (m_connectionHandler->stopped())
-      {
-        if (m_connectionHandlerReady)
+    if (callback) m_stopCbs.push_back(callback);
+    // the shutdown is already in progress, the callback joins it
+    if (m_exiting) return;
+    // prevent infinite loop in handler's shutdown callback
+    m_exiting = true;
+    if (!m_connectionHandlerReady)
+    {
+      // connecting is aborted, onShutdown() completes the stop
+      m_connectionHandler->stop();
+      return;
+    }
+    // the connection handler is stopped after the last transceiver
+    auto pending = std::make_shared<std::size_t>(1);
+    auto done = [this, pending]() {
+      if (--*pending) return;
+      if (m_connectionHandler->stopped())
         {
           // handler's shutdown callback will not called
-          m_connectionHandlerReady = false;
-          m_amqpConnection.reset();
-          m_sentinel.reset();
-          if (m_exitCb) m_exitCb(eNormal);
+          if (m_connectionHandlerReady) finish(eNormal);
         }
-      }
-      else
-      {
-        // prevent infinite loop in handler's shutdown callback
-        m_exiting = true;
+        else
+        {
 #ifndef NDEBUG
 std::clog << "Connector::stop() before handler stop" << std::endl;
 #endif
-        m_connectionHandler->stop();
+          m_connectionHandler->stop();
 #ifndef NDEBUG
 std::clog << "Connector::stop() after handler stop" << std::endl;
 #endif
-      }
+        }
+    };
+    for (auto& i: m_transceivers)
+    {
+      ++*pending;
+      i->stop(done);
+    }
+    done();
   });
 }
 
 template <class TransceiverImpl>
 void Connector<TransceiverImpl>::onConnected()
 {
+  ConnectionCounters::Add(m_counters->connects);
   m_connectionHandlerReady = true;
+  m_starting = false;
 #ifndef NDEBUG
 std::clog << "connection handler m_connectionHandlerReady = " << m_connectionHandlerReady << std::endl;
 #endif
@@ -192,6 +289,8 @@ std::clog << "connection handler m_connectionHandlerReady = " << m_connectionHan
     m_connectionHandler.get(), m_address.login(), m_address.vhost()
   ));
   m_amqpConnection.swap(connection);
+  // new connection has empty outbound queue
+  for (auto& i: m_transceivers) i->setWritable(true);
   m_sentinel.reset();
 #ifndef NDEBUG
 std::clog << "Connector::async_start() after m_sentinel.reset()" << std::endl;
@@ -217,24 +316,24 @@ std::clog << ": " << message;
 #ifndef NDEBUG
 std::clog << std::endl;
 #endif
+  m_starting = false;
   if (m_exiting)
   {
-    // regular stop
+    // regular stop; transceivers still stopping when the connection is
+    // lost are dropped
     m_connectionHandlerReady = false;
-    m_amqpConnection.reset();
-    m_sentinel.reset();
-    if (m_exitCb) m_exitCb(eNormal);
+    for (auto& i: m_transceivers) i->drop();
+    finish(eNormal);
     return;
   }
   if (!m_connectionHandlerReady)
   {
     // can't open connection to broker
-    m_amqpConnection.reset();
-    m_sentinel.reset();
-    if (m_exitCb) m_exitCb(eBrokerConnectError);
+    finish(eBrokerConnectError);
     return;
   }
-  if (m_connectionHandler->amqp_error())
+  if (m_connectionHandler->amqp_error() ||
+      m_connectionHandler->connection_lost())
     {
       for (auto& i: m_transceivers)
       {
@@ -243,10 +342,36 @@ std::clog << std::endl;
 std::clog << i->route_in() << "@" << i->exchange_point() << ": " << i->error() << std::endl;
 #endif
       }
-      m_connectionHandlerReady = false;
-      m_amqpConnection.reset();
-      m_sentinel.reset();
-      if (m_exitCb) m_exitCb(eAmqpError);
+      finish(eAmqpError);
     }
-    else stop();
+    else
+    {
+      // The broker is unreachable, transceivers can't be stopped regularly.
+      for (auto& i: m_transceivers) i->drop();
+      finish(eNormal);
+    }
+}
+
+template <class TransceiverImpl>
+void Connector<TransceiverImpl>::finish(ExitCode code)
+{
+  m_connectionHandlerReady = false;
+  m_amqpConnection.reset();
+  m_sentinel.reset();
+  // the exit callback may start the connector again, stop callbacks are
+  // taken first
+  std::vector<DoneCallback> callbacks;
+  callbacks.swap(m_stopCbs);
+  if (m_exitCb) m_exitCb(code);
+  for (auto& callback: callbacks) callback();
+}
+
+template <class TransceiverImpl>
+void Connector<TransceiverImpl>::onWritable(bool writable)
+{
+#ifndef NDEBUG
+std::clog << "Connector::onWritable() " << writable << std::endl;
+#endif
+  for (auto& i: m_transceivers) i->setWritable(writable);
+  if (writable && m_drainCb) m_drainCb();
 }
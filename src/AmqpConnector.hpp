@@ -1,16 +1,22 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <list>
 #include <string>
+#include <vector>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
 #include <amqpcpp.h>
+#include "AmqpConnectionOptions.hpp"
+#include "AmqpConnectionStats.hpp"
 #include "AmqpTransceiver.hpp"
 
 namespace amqp {
 
 class ConnectionHandler;
+class TlsContext;
 
 ///
 /// Шаблонный класс, реализующий обертку библиотеки AMQP-CPP.
@@ -20,6 +26,17 @@ class ConnectionHandler;
 /// умолчанию -- класс Transceiver. По умолчанию Connector инстанциируется с
 /// ним.
 ///
+/// Все обработчики ввода/вывода соединения, обратные вызовы коннектора и
+/// его приемопередатчиков выполняются через общий strand коннектора (см.
+/// strand()). Поэтому цикл службы ввода/вывода может быть запущен в
+/// нескольких потоках, а разные коннекторы работают параллельно. Методы
+/// async_start(), open(), close(), run() и stop() можно вызывать из любого
+/// потока, они передают работу в strand и не ждут ее завершения; цикл
+/// службы ввода/вывода они не выполняют (кроме синхронного start()). Методы
+/// transceiver(), remove() и send(), а также методы приемопередатчиков,
+/// вызываются до запуска коннектора или в контексте его strand, например,
+/// из обратных вызовов.
+///
 /// @author cycleg
 ///
 template<class TransceiverImpl = Transceiver>
@@ -33,7 +50,8 @@ class Connector
     {
       eNormal, ///< Ошибок нет.
       eBrokerConnectError, ///< Не удалось соединиться с брокером AMQP.
-      eAmqpError ///< Библиотека AMQP-CPP сообщила об ошибке.
+      eAmqpError ///< Библиотека AMQP-CPP сообщила об ошибке или соединение
+                 ///< с брокером потеряно.
     };
 
     ///
@@ -54,19 +72,35 @@ class Connector
     ///
     typedef std::function<void()> StartedCallback;
     ///
+    /// Указатель на функцию обратного вызова при завершении операции с
+    /// приемопередатчиками.
+    ///
+    typedef std::function<void()> DoneCallback;
+    ///
     /// Указатель на функцию обратного вызова при отключении коннектора.
     ///
     /// @param [in] ExitCode Код завершения коннектора.
     ///
     typedef std::function<void(ExitCode)> ExitCallback;
+    ///
+    /// Указатель на функцию обратного вызова при освобождении очереди
+    /// исходящих данных.
+    ///
+    typedef std::function<void()> DrainCallback;
 
     ///
     /// Конструктор.
     ///
     /// @param [in] service Ссылка на экземпляр службы ввода/вывода.
     /// @param [in] brokerUrl URL брокера, с которым работает коннектор.
+    /// @param [in] options Параметры соединения с брокером (необязательный).
+    ///
+    /// Кроме схем amqp:// и amqps://, URL брокера может иметь схему
+    /// amqp+unix:// для подключения через сокет домена Unix, например,
+    /// amqp+unix://guest:guest@%2Fvar%2Frun%2Frabbitmq.sock/vhost.
     ///
-    Connector(boost::asio::io_service& service, std::string brokerUrl);
+    Connector(boost::asio::io_service& service, std::string brokerUrl,
+              const ConnectionOptions& options = ConnectionOptions());
     ///
     /// Деструктор.
     ///
@@ -83,6 +117,27 @@ class Connector
     /// @return Готов или нет.
     ///
     inline bool ready() const { return m_connectionHandlerReady; }
+    ///
+    /// Готовность коннектора принимать сообщения на отправку.
+    ///
+    /// @return Готов или нет.
+    ///
+    /// Коннектор не готов, пока объем очереди исходящих данных соединения
+    /// выше нижней границы после того, как достиг верхней (см.
+    /// ConnectionOptions::highWatermark и ConnectionOptions::lowWatermark).
+    /// Когда очередь освободится, будет вызвана функция, назначенная
+    /// onDrain().
+    ///
+    bool writable() const;
+    ///
+    /// Объем исходящих данных соединения с брокером.
+    ///
+    /// @return Число байтов, ожидающих отправки или отправляемых.
+    ///
+    /// Читается из счетчиков статистики (ConnectionStats::outQueueBytes),
+    /// поэтому вызывается из любого потока.
+    ///
+    std::size_t outbound_bytes() const;
 
     ///
     /// Назначить обратный вызов для завершения коннектора.
@@ -97,12 +152,31 @@ class Connector
     ///
     inline ExitCallback getOnExit() const { return m_exitCb; }
     ///
+    /// Назначить обратный вызов для освобождения очереди исходящих данных.
+    ///
+    /// @param [in] callback Указатель на функцию обратного вызова.
+    ///
+    /// Функция вызывается, когда коннектор снова становится готов принимать
+    /// сообщения на отправку, см. writable().
+    ///
+    inline void onDrain(DrainCallback callback) { m_drainCb = callback; }
+    ///
     /// Извлечь ссылку на службу ввода/вывода, используемую коннектором.
     ///
     /// @return Ссылка на экземпляр службы ввода/вывода.
     ///
     inline boost::asio::io_service& io_service() { return m_service; }
     ///
+    /// Извлечь ссылку на strand коннектора.
+    ///
+    /// @return Ссылка на strand.
+    ///
+    /// Через strand выполняются все обработчики соединения с брокером и
+    /// приемопередатчиков. Работу с приемопередатчиками из посторонних
+    /// потоков следует передавать в него, например, через dispatch().
+    ///
+    inline boost::asio::io_service::strand& strand() { return m_strand; }
+    ///
     /// Получить URL на брокер, с которым работает коннектором.
     ///
     /// @return URL брокера AMQP.
@@ -111,6 +185,30 @@ class Connector
     /// по умолчанию.
     ///
     inline std::string url() const { return std::string(m_address); }
+    ///
+    /// Получить параметры соединения с брокером.
+    ///
+    /// @return Параметры соединения.
+    ///
+    inline const ConnectionOptions& options() const { return m_options; }
+    ///
+    /// Получить контекст TLS коннектора.
+    ///
+    /// @return Указатель на контекст TLS или nullptr, если URL брокера не
+    ///         amqps://.
+    ///
+    /// Контекст и кэш сессии TLS в нем сохраняются при переподключениях.
+    ///
+    inline TlsContext* tls() const { return m_tls.get(); }
+    ///
+    /// Статистика ввода/вывода.
+    ///
+    /// @return Снимок счетчиков соединения и приемопередатчиков коннектора
+    ///         за все время его жизни.
+    ///
+    /// Можно вызывать из любого потока.
+    ///
+    inline ConnectionStats stats() const { return m_counters->snapshot(); }
 
     ///
     /// Начало списка приемопередатчиков коннектора.
@@ -145,14 +243,24 @@ class Connector
     /// Включить указанный приемопередатчик.
     ///
     /// @param [in] i Итератор приемопередатчика.
+    /// @param [in] callback Обратный вызов по завершении запуска
+    ///                      (необязательный).
+    ///
+    /// Запуск происходит асинхронно. Результат проверяется методом ready()
+    /// приемопередатчика. Если коннектор не готов к работе, метод не делает
+    /// ничего.
     ///
-    void open(iterator i);
+    void open(iterator i, DoneCallback callback = nullptr);
     ///
     /// Выключить указанный приемопередатчик.
     ///
     /// @param [in] i Итератор приемопередатчика.
+    /// @param [in] callback Обратный вызов по завершении остановки
+    ///                      (необязательный).
+    ///
+    /// Остановка происходит асинхронно.
     ///
-    void close(iterator i);
+    void close(iterator i, DoneCallback callback = nullptr);
     ///
     /// Удалить указанный приемопередатчик.
     ///
@@ -168,16 +276,27 @@ class Connector
     /// @param [in] route Маршрут отправки.
     /// @param [in] mandatory Флаг "mandatory" (необязательный, по умолчанию
     ///                       установлен).
+    /// @param [in] confirmed Обратный вызов при подтверждении публикации
+    ///                       брокером (необязательный), см.
+    ///                       Transceiver::enableConfirms().
     ///
     template<class Message>
     bool send(iterator i, const Message& message,
-              const std::string& route, bool mandatory = true)
+              const std::string& route, bool mandatory = true,
+              Transceiver::ConfirmCallback confirmed = nullptr)
     {
-      // TODO: thread safety
       if (!m_connectionHandlerReady) return false;
-      return (*i)->send(message, route, mandatory);
+      return (*i)->send(message, route, mandatory, confirmed);
     }
 
+    ///
+    /// Обновить адреса брокера в кэше разрешения имен в фоне.
+    ///
+    /// Полезно вызывать, пока выдерживается пауза перед повторным
+    /// подключением: к ее окончанию адреса будут в кэше. Для транспорта,
+    /// отличного от TCP, метод не делает ничего.
+    ///
+    void resolve();
     ///
     /// Инициировать работу с брокером асинхронно.
     ///
@@ -199,32 +318,46 @@ class Connector
     /// обратного вызова: на звершение работы коннектора или на успешное
     /// подключение к брокеру.
     ///
+    /// Пока подключение не завершено, метод сам выполняет обработчики службы
+    /// ввода/вывода. Поэтому его нельзя вызывать из обработчиков этой службы,
+    /// а также когда ее цикл уже работает в других потоках.
+    ///
     void start();
     ///
     /// Запустить цикл работы с брокером.
     ///
-    /// Метод синхронный, запускает все созданные и не запущенные на момент
-    /// вызова приемопередатчики. После успешного инициирования работы с
+    /// @param [in] callback Обратный вызов по завершении запуска всех
+    ///                      приемопередатчиков (необязательный).
+    ///
+    /// Запускает асинхронно все созданные и не запущенные на момент вызова
+    /// приемопередатчики. Обратный вызов выполняется, когда запуск каждого из
+    /// них завершится, удачно или нет. После успешного инициирования работы с
     /// брокером и до ее завершения может вызываться многократно. Это полезно,
     /// если нужно создать и запустить сразу несколько приемопередатчиков.
     ///
     /// Если работа с брокером не была ранее успешно инициирована, то данный
     /// метод не делает ничего.
     ///
-    void run();
+    void run(DoneCallback callback = nullptr);
     ///
     /// Завершить работу с брокером.
     ///
-    /// Отключение от брокера происходит асинхронно, по завершении отключения
-    /// производится обратный вызов, ранее заданный через onExit(). Если вызов
-    /// не установлен, то проверить завершенность можно с помощью ready().
-    /// Если метод возвращает false, то все приемопередатчики уже остановлены,
-    /// а обработчик соединения, по крайней мере, отключается.
-    ///
-    /// Если ранее экземпляр не был ранее успешно инициирован вызовом start()
-    /// или async_start(), то данный метод не делает ничего.
+    /// @param [in] callback Обратный вызов по завершении отключения
+    ///                      (необязательный).
     ///
-    void stop();
+    /// Отключение от брокера происходит асинхронно, по завершении отключения
+    /// производится обратный вызов, ранее заданный через onExit(), а затем
+    /// callback. Если вызовы не установлены, то проверить завершенность можно
+    /// с помощью ready(). Если метод возвращает false, то все
+    /// приемопередатчики уже остановлены, а обработчик соединения, по крайней
+    /// мере, отключается. Повторный вызов до завершения отключения только
+    /// добавляет свой callback.
+    ///
+    /// Если подключение к брокеру еще идет, оно прерывается, и onExit()
+    /// получает код eNormal. Если коннектор не запущен, то callback
+    /// выполняется сразу (через strand), а вызов из onExit() не производится.
+    ///
+    void stop(DoneCallback callback = nullptr);
 
   private:
     ///
@@ -238,18 +371,47 @@ class Connector
     ///
     /// В случае нормального закрытия соединения вызывается m_exitCb с кодом
     /// eNormal, в случае неудачи при соединении -- с кодом
-    /// eBrokerConnectError, в случае ошибки во время работы с брокером -- с
-    /// кодом eAmqpError. В последнем случае предварительно сбрасываются, но
+    /// eBrokerConnectError, в случае ошибки во время работы с брокером или
+    /// потери соединения (ошибка ввода/вывода, нет heartbeat) -- с кодом
+    /// eAmqpError. В последнем случае предварительно сбрасываются, но
     /// не удаляются, все имеющиеся приемопередатчики.
     ///
     void onShutdown(const std::string& message);
+    ///
+    /// Завершить работу коннектора.
+    ///
+    /// @param [in] code Код завершения.
+    ///
+    /// Освобождает соединение AMQP, вызывает m_exitCb и обратные вызовы,
+    /// накопленные stop().
+    ///
+    void finish(ExitCode code);
+    ///
+    /// Сменилась готовность соединения принимать исходящие данные.
+    ///
+    /// @param [in] writable Готово соединение или нет.
+    ///
+    /// Готовность передается всем приемопередатчикам. При восстановлении
+    /// готовности вызывается m_drainCb.
+    ///
+    void onWritable(bool writable);
 
     AMQP::Address m_address; ///< Адрес брокера AMQP.
+    ConnectionOptions m_options; ///< Параметры соединения с брокером.
+    std::string m_unixPath; ///< Путь к сокету брокера для amqp+unix://.
+    std::shared_ptr<TlsContext> m_tls; ///< Контекст TLS для amqps://.
+    std::shared_ptr<ConnectionCounters> m_counters; ///< Счетчики статистики,
+                                                    ///< общие для всех
+                                                    ///< соединений и
+                                                    ///< приемопередатчиков.
     TransceiverList m_transceivers; ///< Контейнер приемопередатчиков.
     boost::asio::io_service& m_service; ///< Ссылка на экземпляр цикла
                                         ///< ввода/вывода boost::asio,
                                         ///< используемого экземпляром
                                         ///< данного класса.
+    boost::asio::io_service::strand m_strand; ///< Strand, через который
+                                              ///< выполняются все
+                                              ///< обработчики коннектора.
     std::shared_ptr< boost::asio::io_service::work >
       m_sentinel; ///< "Сторож", не дает циклу службы ввода/вывода, заданной в
                   ///< конструторе завершиться до окончания работы в
@@ -269,12 +431,19 @@ class Connector
                                                               ///< на обработчик
                                                               ///< соединения с
                                                               ///< брокером.
-    bool m_exiting, ///< Признак запуска штатной остановки через stop().
-         m_connectionHandlerReady; ///< Признак готовности обработчика
-                                   ///< соединения с брокером к работе.
+    bool m_exiting; ///< Признак запуска штатной остановки через stop().
+    std::atomic<bool> m_connectionHandlerReady, ///< Признак готовности
+                                                ///< обработчика соединения
+                                                ///< с брокером к работе.
+                      m_starting; ///< Признак, что идет синхронное
+                                  ///< подключение к брокеру в start().
     StartedCallback m_startedCb; ///< Обратный вызов после установления
                                  ///< успешного соединения с брокером.
     ExitCallback m_exitCb; ///< Обратный вызов при завершении работы.
+    std::vector<DoneCallback> m_stopCbs; ///< Обратные вызовы незавершенной
+                                         ///< остановки.
+    DrainCallback m_drainCb; ///< Обратный вызов при освобождении очереди
+                             ///< исходящих данных.
 };
 
 } // namespace amqp
@@ -0,0 +1,226 @@
+#ifndef NDEBUG
+#include <iostream>
+#endif
+#include <iterator>
+#include <limits>
+#include <boost/bind.hpp>
+#include "AmqpConnectorPool.hpp"
+
+using namespace amqp;
+
+template class ConnectorPool<Transceiver>; // инстанциирование шаблона по умолчанию
+
+template <class TransceiverImpl>
+typename ConnectorPool<TransceiverImpl>::PlacementPolicy
+ConnectorPool<TransceiverImpl>::RoundRobin()
+{
+  auto next = std::make_shared<std::size_t>(0);
+  return [next](const std::string&, const ConnectorList& connectors) {
+    return (*next)++ % connectors.size();
+  };
+}
+
+template <class TransceiverImpl>
+typename ConnectorPool<TransceiverImpl>::PlacementPolicy
+ConnectorPool<TransceiverImpl>::LeastLoaded()
+{
+  return [](const std::string&, const ConnectorList& connectors) {
+    std::size_t best = 0,
+                bestBytes = std::numeric_limits<std::size_t>::max(),
+                bestCount = std::numeric_limits<std::size_t>::max();
+    for (std::size_t n = 0; n < connectors.size(); ++n)
+    {
+      std::size_t bytes = connectors[n]->outbound_bytes(),
+                  count = std::distance(connectors[n]->begin(),
+                                        connectors[n]->end());
+      if ((bytes < bestBytes) || ((bytes == bestBytes) && (count < bestCount)))
+      {
+        best = n;
+        bestBytes = bytes;
+        bestCount = count;
+      }
+    }
+    return best;
+  };
+}
+
+template <class TransceiverImpl>
+typename ConnectorPool<TransceiverImpl>::PlacementPolicy
+ConnectorPool<TransceiverImpl>::ExchangeHash()
+{
+  return [](const std::string& exchange, const ConnectorList& connectors) {
+    return std::hash<std::string>()(exchange) % connectors.size();
+  };
+}
+
+template <class TransceiverImpl>
+ConnectorPool<TransceiverImpl>::ConnectorPool(boost::asio::io_service& service,
+                                              std::string brokerUrl,
+                                              std::size_t size,
+                                              PlacementPolicy policy,
+                                              const ConnectionOptions& options):
+  m_service(service),
+  m_strand(service),
+  m_policy(policy),
+  m_running(0),
+  m_started(0),
+  m_stopping(false),
+  m_exitCode(ConnectorType::eNormal),
+  m_startedCb(nullptr),
+  m_exitCb(nullptr)
+{
+  if (!m_policy) m_policy = RoundRobin();
+  if (size == 0) size = 1;
+  for (std::size_t n = 0; n < size; ++n)
+  {
+    auto connector = std::make_shared<ConnectorType>(service, brokerUrl, options);
+    connector->onExit(m_strand.wrap(
+      boost::bind(&ConnectorPool<TransceiverImpl>::onConnectorExit, this, _1)
+    ));
+    m_connectors.push_back(connector);
+  }
+}
+
+template <class TransceiverImpl>
+ConnectorPool<TransceiverImpl>::~ConnectorPool()
+{
+}
+
+template <class TransceiverImpl>
+bool ConnectorPool<TransceiverImpl>::ready() const
+{
+  for (auto& c: m_connectors)
+    if (!c->ready()) return false;
+  return true;
+}
+
+template <class TransceiverImpl>
+std::size_t ConnectorPool<TransceiverImpl>::outbound_bytes() const
+{
+  std::size_t bytes = 0;
+  for (auto& c: m_connectors) bytes += c->outbound_bytes();
+  return bytes;
+}
+
+template <class TransceiverImpl>
+ConnectionStats ConnectorPool<TransceiverImpl>::stats() const
+{
+  ConnectionStats stats;
+  for (auto& c: m_connectors) stats += c->stats();
+  return stats;
+}
+
+template <class TransceiverImpl>
+typename ConnectorPool<TransceiverImpl>::iterator
+ConnectorPool<TransceiverImpl>::transceiver(const std::string& exchange,
+                                            const std::string& queue_,
+                                            const std::string& route_in,
+                                            bool listener)
+{
+  std::size_t n = m_policy(exchange, m_connectors) % m_connectors.size();
+#ifndef NDEBUG
+std::clog << "ConnectorPool::transceiver() " << exchange << " -> connection " << n << std::endl;
+#endif
+  iterator i = m_connectors[n]->transceiver(exchange, queue_, route_in, listener);
+  m_placement[i->get()] = n;
+  return i;
+}
+
+template <class TransceiverImpl>
+void ConnectorPool<TransceiverImpl>::remove(iterator i)
+{
+  auto placement = m_placement.find(i->get());
+  if (placement == m_placement.end()) return;
+  std::size_t n = placement->second;
+  m_placement.erase(placement);
+  m_connectors[n]->remove(i);
+}
+
+template <class TransceiverImpl>
+void ConnectorPool<TransceiverImpl>::async_start(StartedCallback callback)
+{
+  m_strand.dispatch([this, callback]() {
+    if (m_running) return;
+    m_running = m_connectors.size();
+    m_started = 0;
+    m_stopping = false;
+    m_exitCode = ConnectorType::eNormal;
+    m_startedCb = callback;
+    for (auto& c: m_connectors)
+      c->async_start(m_strand.wrap(
+        boost::bind(&ConnectorPool<TransceiverImpl>::onStarted, this)
+      ));
+  });
+}
+
+template <class TransceiverImpl>
+void ConnectorPool<TransceiverImpl>::run(DoneCallback callback)
+{
+  m_strand.dispatch([this, callback]() {
+    // the callback is called after every connector has started its
+    // transceivers
+    auto pending = std::make_shared<std::size_t>(1);
+    auto done = [pending, callback]() {
+      if (--*pending) return;
+      if (callback) callback();
+    };
+    for (auto& c: m_connectors)
+      if (c->ready())
+      {
+        ++*pending;
+        c->run(m_strand.wrap(done));
+      }
+    done();
+  });
+}
+
+template <class TransceiverImpl>
+void ConnectorPool<TransceiverImpl>::stop(DoneCallback callback)
+{
+  m_strand.dispatch([this, callback]() {
+    if (!m_running)
+    {
+      if (callback) m_strand.post(callback);
+      return;
+    }
+    if (callback) m_stopCbs.push_back(callback);
+    if (m_stopping) return;
+    m_stopping = true;
+    // connectors still connecting abort their attempts
+    for (auto& c: m_connectors) c->stop();
+  });
+}
+
+template <class TransceiverImpl>
+void ConnectorPool<TransceiverImpl>::onStarted()
+{
+  // the connector has already got its stop()
+  if (m_stopping) return;
+  if (++m_started < m_connectors.size()) return;
+#ifndef NDEBUG
+std::clog << "ConnectorPool: " << m_started << " connections established" << std::endl;
+#endif
+  if (m_startedCb) m_startedCb();
+}
+
+template <class TransceiverImpl>
+void ConnectorPool<TransceiverImpl>::onConnectorExit(ExitCode code)
+{
+#ifndef NDEBUG
+std::clog << "ConnectorPool: connection finished with code " << code << std::endl;
+#endif
+  --m_running;
+  if (!m_stopping)
+  {
+    // one connection is lost, the pool works as a whole
+    m_stopping = true;
+    m_exitCode = code;
+    for (auto& c: m_connectors) c->stop();
+  }
+  if (m_running) return;
+  m_stopping = false;
+  std::vector<DoneCallback> callbacks;
+  callbacks.swap(m_stopCbs);
+  if (m_exitCb) m_exitCb(m_exitCode);
+  for (auto& callback: callbacks) callback();
+}
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include "AmqpConnector.hpp"
+
+namespace amqp {
+
+///
+/// Пул соединений с брокером AMQP.
+
+/// Открывает несколько соединений (экземпляров amqp::Connector) с одним и тем
+/// же брокером и распределяет между ними создаваемые приемопередатчики. Тем
+/// самым каналы AMQP не делят один поток TCP и один процесс соединения на
+/// стороне брокера. Соединение для нового приемопередатчика выбирается
+/// политикой размещения, см. PlacementPolicy, RoundRobin(), LeastLoaded() и
+/// ExchangeHash().
+///
+/// Интерфейс работы с приемопередатчиками повторяет amqp::Connector: методы
+/// transceiver(), open(), close(), remove() и send() принимают и возвращают
+/// итераторы того коннектора, которому принадлежит приемопередатчик.
+///
+/// Пул работает как одно целое: async_start() завершается успешно, когда
+/// установлены все соединения. Если одно из соединений не установлено или
+/// разорвано, остальные останавливаются, а обратный вызов, заданный
+/// onExit(), получает код завершения первого неудачного соединения.
+///
+/// @author cycleg
+///
+template<class TransceiverImpl = Transceiver>
+class ConnectorPool
+{
+  public:
+    ///
+    /// Тип коннектора в пуле.
+    ///
+    typedef Connector<TransceiverImpl> ConnectorType;
+    ///
+    /// Указатель на экземпляр коннектора.
+    ///
+    typedef std::shared_ptr<ConnectorType> ConnectorPtr;
+    ///
+    /// Тип списка коннекторов пула.
+    ///
+    typedef std::vector<ConnectorPtr> ConnectorList;
+    ///
+    /// Итератор приемопередатчика.
+    ///
+    typedef typename ConnectorType::iterator iterator;
+    ///
+    /// Код завершения работы пула.
+    ///
+    typedef typename ConnectorType::ExitCode ExitCode;
+    ///
+    /// Указатель на функцию обратного вызова при успешном запуске пула.
+    ///
+    typedef typename ConnectorType::StartedCallback StartedCallback;
+    ///
+    /// Указатель на функцию обратного вызова при завершении операции с
+    /// приемопередатчиками.
+    ///
+    typedef typename ConnectorType::DoneCallback DoneCallback;
+    ///
+    /// Указатель на функцию обратного вызова при завершении работы пула.
+    ///
+    typedef typename ConnectorType::ExitCallback ExitCallback;
+    ///
+    /// Политика размещения приемопередатчиков по соединениям.
+    ///
+    /// @param [in] exchange Имя точки обмена нового приемопередатчика.
+    /// @param [in] connectors Коннекторы пула.
+    /// @return Индекс коннектора в connectors.
+    ///
+    typedef std::function<std::size_t(const std::string& exchange,
+                                      const ConnectorList& connectors)>
+      PlacementPolicy;
+
+    ///
+    /// Политика "по кругу".
+    ///
+    /// @return Политика, размещающая приемопередатчики по соединениям
+    ///         поочередно.
+    ///
+    static PlacementPolicy RoundRobin();
+    ///
+    /// Политика "наименее загруженное".
+    ///
+    /// @return Политика, выбирающая соединение с наименьшим объемом
+    ///         исходящих данных, а при равенстве -- с наименьшим числом
+    ///         приемопередатчиков.
+    ///
+    /// До запуска пула исходящих данных нет ни у одного соединения, так что
+    /// приемопередатчики размещаются по наименьшему их числу.
+    ///
+    static PlacementPolicy LeastLoaded();
+    ///
+    /// Политика "хэш точки обмена".
+    ///
+    /// @return Политика, выбирающая соединение по хэшу имени точки обмена.
+    ///         Приемопередатчики одной точки обмена оказываются в одном
+    ///         соединении.
+    ///
+    static PlacementPolicy ExchangeHash();
+
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] service Ссылка на экземпляр службы ввода/вывода.
+    /// @param [in] brokerUrl URL брокера, с которым работает пул.
+    /// @param [in] size Число соединений (не меньше одного).
+    /// @param [in] policy Политика размещения приемопередатчиков
+    ///                    (необязательный, по умолчанию -- RoundRobin()).
+    /// @param [in] options Параметры соединений с брокером (необязательный).
+    ///
+    ConnectorPool(boost::asio::io_service& service, std::string brokerUrl,
+                  std::size_t size, PlacementPolicy policy = RoundRobin(),
+                  const ConnectionOptions& options = ConnectionOptions());
+    ///
+    /// Деструктор.
+    ///
+    ~ConnectorPool();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    ConnectorPool(const ConnectorPool&) = delete;
+
+    ///
+    /// Готовность пула к работе с брокером AMQP.
+    ///
+    /// @return Готовы все соединения или нет.
+    ///
+    bool ready() const;
+    ///
+    /// Суммарный объем исходящих данных всех соединений пула.
+    ///
+    /// @return Число байтов, ожидающих отправки или отправляемых.
+    ///
+    std::size_t outbound_bytes() const;
+    ///
+    /// Суммарная статистика ввода/вывода всех соединений пула.
+    ///
+    /// @return Снимок счетчиков, см. Connector::stats().
+    ///
+    ConnectionStats stats() const;
+    ///
+    /// Число соединений в пуле.
+    ///
+    /// @return Число соединений.
+    ///
+    inline std::size_t size() const { return m_connectors.size(); }
+    ///
+    /// Получить коннектор пула по индексу.
+    ///
+    /// @param [in] n Индекс коннектора.
+    /// @return Указатель на коннектор.
+    ///
+    inline ConnectorType* connector(std::size_t n) const
+    { return m_connectors[n].get(); }
+    ///
+    /// Получить коннектор, которому принадлежит приемопередатчик.
+    ///
+    /// @param [in] i Итератор приемопередатчика.
+    /// @return Указатель на коннектор.
+    ///
+    inline ConnectorType* connector(iterator i) const
+    { return m_connectors[m_placement.at(i->get())].get(); }
+
+    ///
+    /// Назначить обратный вызов для завершения работы пула.
+    ///
+    /// @param [in] callback Указатель на функцию обратного вызова.
+    ///
+    inline void onExit(ExitCallback callback) { m_exitCb = callback; }
+    ///
+    /// Получить указатель на текущую функцию обратного вызова.
+    ///
+    /// @return Указатель на функцию обратного вызова.
+    ///
+    inline ExitCallback getOnExit() const { return m_exitCb; }
+    ///
+    /// Извлечь ссылку на службу ввода/вывода, используемую пулом.
+    ///
+    /// @return Ссылка на экземпляр службы ввода/вывода.
+    ///
+    inline boost::asio::io_service& io_service() { return m_service; }
+    ///
+    /// Получить URL на брокер, с которым работает пул.
+    ///
+    /// @return URL брокера AMQP.
+    ///
+    inline std::string url() const { return m_connectors.front()->url(); }
+
+    ///
+    /// Создать приемопередатчик с указанными параметрами.
+    ///
+    /// @param [in] exchange Имя точки обмена AMQP.
+    /// @param [in] queue_ Имя очереди сообщений.
+    /// @param [in] route_in Маршрут входящих сообщений.
+    /// @param [in] listener Флаг, что экземпляр будет работать на прием.
+    /// @return Итератор вновь созданного приемопередатчика.
+    ///
+    /// Соединение для приемопередатчика выбирается политикой размещения.
+    ///
+    iterator transceiver(const std::string& exchange,
+                         const std::string& queue_,
+                         const std::string& route_in,
+                         bool listener);
+    ///
+    /// Включить указанный приемопередатчик.
+    ///
+    /// @param [in] i Итератор приемопередатчика.
+    /// @param [in] callback Обратный вызов по завершении запуска
+    ///                      (необязательный).
+    ///
+    /// См. Connector::open().
+    ///
+    inline void open(iterator i, DoneCallback callback = nullptr)
+    { connector(i)->open(i, callback); }
+    ///
+    /// Выключить указанный приемопередатчик.
+    ///
+    /// @param [in] i Итератор приемопередатчика.
+    /// @param [in] callback Обратный вызов по завершении остановки
+    ///                      (необязательный).
+    ///
+    /// См. Connector::close().
+    ///
+    inline void close(iterator i, DoneCallback callback = nullptr)
+    { connector(i)->close(i, callback); }
+    ///
+    /// Удалить указанный приемопередатчик.
+    ///
+    /// @param [in] i Итератор приемопередатчика.
+    ///
+    void remove(iterator i);
+
+    ///
+    /// Отправить сообщение через указанный приемопередатчик.
+    ///
+    /// @param [in] i Итератор приемопередатчика.
+    /// @param [in] message Исходящее сообщение.
+    /// @param [in] route Маршрут отправки.
+    /// @param [in] mandatory Флаг "mandatory" (необязательный, по умолчанию
+    ///                       установлен).
+    /// @param [in] confirmed Обратный вызов при подтверждении публикации
+    ///                       брокером (необязательный), см.
+    ///                       Transceiver::enableConfirms().
+    ///
+    template<class Message>
+    bool send(iterator i, const Message& message,
+              const std::string& route, bool mandatory = true,
+              Transceiver::ConfirmCallback confirmed = nullptr)
+    {
+      return connector(i)->send(i, message, route, mandatory, confirmed);
+    }
+
+    ///
+    /// Инициировать работу с брокером асинхронно.
+    ///
+    /// @param [in] callback Функция обратного вызова, выполняемая, когда
+    ///                      установлены все соединения пула (необязательный).
+    ///
+    void async_start(StartedCallback callback = nullptr);
+    ///
+    /// Запустить цикл работы с брокером во всех соединениях.
+    ///
+    /// @param [in] callback Обратный вызов по завершении запуска всех
+    ///                      приемопередатчиков (необязательный).
+    ///
+    /// См. Connector::run().
+    ///
+    void run(DoneCallback callback = nullptr);
+    ///
+    /// Завершить работу с брокером во всех соединениях.
+    ///
+    /// @param [in] callback Обратный вызов по завершении отключения
+    ///                      (необязательный).
+    ///
+    /// По завершении отключения всех соединений производится обратный
+    /// вызов, ранее заданный через onExit(), а затем callback. Подключения,
+    /// которые еще идут, прерываются. См. Connector::stop().
+    ///
+    void stop(DoneCallback callback = nullptr);
+
+  private:
+    ///
+    /// Соединение с брокером установлено.
+    ///
+    /// Если пул уже останавливается, не делает ничего: соединение
+    /// закрывается вызовом stop(), переданным ему ранее.
+    ///
+    void onStarted();
+    ///
+    /// Соединение с брокером завершено.
+    ///
+    /// @param [in] code Код завершения соединения.
+    ///
+    /// Если соединение завершилось не по вызову stop(), останавливаются и
+    /// все остальные. Когда завершены все соединения, вызывается m_exitCb.
+    ///
+    void onConnectorExit(ExitCode code);
+
+    boost::asio::io_service& m_service; ///< Ссылка на экземпляр цикла
+                                        ///< ввода/вывода boost::asio.
+    boost::asio::io_service::strand m_strand; ///< Strand, через который
+                                              ///< выполняются обработчики
+                                              ///< событий коннекторов пула.
+    ConnectorList m_connectors; ///< Коннекторы пула.
+    std::unordered_map<const TransceiverImpl*, std::size_t>
+      m_placement; ///< Индекс коннектора каждого приемопередатчика.
+    PlacementPolicy m_policy; ///< Политика размещения приемопередатчиков.
+    std::size_t m_running, ///< Число работающих или подключающихся
+                           ///< соединений.
+                m_started; ///< Число установленных соединений.
+    bool m_stopping; ///< Признак, что соединения пула останавливаются.
+    ExitCode m_exitCode; ///< Код завершения пула: код первого соединения,
+                         ///< завершившегося до вызова stop().
+    StartedCallback m_startedCb; ///< Обратный вызов после установления всех
+                                 ///< соединений.
+    ExitCallback m_exitCb; ///< Обратный вызов при завершении работы.
+    std::vector<DoneCallback> m_stopCbs; ///< Обратные вызовы незавершенной
+                                         ///< остановки.
+};
+
+} // namespace amqp
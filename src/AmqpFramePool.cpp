@@ -0,0 +1,53 @@
+#include "AmqpFramePool.hpp"
+
+using namespace amqp;
+
+const std::size_t FramePool::MinClassShift = 6;
+const std::size_t FramePool::ClassCount = 16;
+// four blocks of the default maximum frame (131072 bytes)
+const std::size_t FramePool::MaxClassBytes = 512 * 1024;
+
+FramePool::FramePool():
+  m_free(ClassCount)
+{
+}
+
+FramePool::~FramePool()
+{
+  for (auto& list: m_free)
+    for (auto block: list) delete[] block;
+}
+
+FrameBuffer FramePool::acquire(std::size_t size)
+{
+  FrameBuffer buffer;
+  buffer.size = size;
+  buffer.sizeClass = 0;
+  while ((buffer.sizeClass < ClassCount) &&
+         ((std::size_t(1) << (buffer.sizeClass + MinClassShift)) < size))
+    ++buffer.sizeClass;
+  if (buffer.sizeClass == ClassCount)
+  {
+    // too large to keep, allocate exactly
+    buffer.data = new char[size];
+    return buffer;
+  }
+  std::vector<char*>& list = m_free[buffer.sizeClass];
+  if (list.empty())
+    buffer.data = new char[std::size_t(1) << (buffer.sizeClass + MinClassShift)];
+    else
+    {
+      buffer.data = list.back();
+      list.pop_back();
+    }
+  return buffer;
+}
+
+void FramePool::release(const FrameBuffer& buffer)
+{
+  if ((buffer.sizeClass < ClassCount) &&
+      ((m_free[buffer.sizeClass].size() + 1) <<
+         (buffer.sizeClass + MinClassShift)) <= MaxClassBytes)
+    m_free[buffer.sizeClass].push_back(buffer.data);
+    else delete[] buffer.data;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace amqp {
+
+///
+/// Буфер исходящего кадра AMQP.
+///
+/// Память буфера принадлежит пулу FramePool, из которого буфер был получен,
+/// и должна быть возвращена в него же.
+///
+struct FrameBuffer
+{
+  char* data; ///< Содержимое кадра.
+  std::size_t size; ///< Размер кадра.
+  std::size_t sizeClass; ///< Класс размера блока памяти в пуле.
+};
+
+///
+/// Пул буферов исходящих кадров.
+
+/// Блоки памяти распределяются по классам размеров, кратным степеням двойки,
+/// от 64 байт до 2 Мб. Запрос буфера выдает свободный блок наименьшего
+/// подходящего класса, а возвращенный блок сохраняется для повторного
+/// использования. Таким образом, при установившемся потоке исходящих кадров
+/// выделения памяти не происходит. Блоки больше максимального класса
+/// выделяются и освобождаются всякий раз.
+///
+/// Свободные блоки каждого класса хранятся в пределах MaxClassBytes, лишние
+/// освобождаются при возврате. Поэтому всплеск крупных кадров не оставляет
+/// за соединением память на все время его жизни, а классы крупнее предела
+/// не хранятся вовсе.
+///
+/// Класс не является потокобезопасным.
+///
+/// @author cycleg
+///
+class FramePool
+{
+  public:
+    ///
+    /// Конструктор.
+    ///
+    FramePool();
+    ///
+    /// Деструктор.
+    ///
+    /// Освобождает память всех блоков, возвращенных в пул.
+    ///
+    ~FramePool();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    FramePool(const FramePool&) = delete;
+
+    ///
+    /// Получить буфер.
+    ///
+    /// @param [in] size Требуемый размер буфера.
+    /// @return Буфер, поле size которого равно требуемому размеру.
+    ///
+    FrameBuffer acquire(std::size_t size);
+    ///
+    /// Вернуть буфер в пул.
+    ///
+    /// @param [in] buffer Ранее полученный из пула буфер.
+    ///
+    void release(const FrameBuffer& buffer);
+
+  private:
+    static const std::size_t MinClassShift; ///< Двоичный логарифм размера
+                                            ///< блока наименьшего класса.
+    static const std::size_t ClassCount; ///< Число классов размеров.
+    static const std::size_t MaxClassBytes; ///< Наибольший объем свободных
+                                            ///< блоков одного класса.
+
+    std::vector< std::vector<char*> > m_free; ///< Свободные блоки по классам.
+};
+
+} // namespace amqp
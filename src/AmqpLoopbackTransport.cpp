@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstring>
+#include <boost/asio/error.hpp>
+#include "AmqpLoopbackTransport.hpp"
+
+using namespace amqp;
+
+LoopbackTransport::LoopbackTransport(const boost::asio::io_service::strand& strand,
+                                     PeerCallback peer):
+  Transport(strand),
+  m_peer(peer),
+  m_inHead(0),
+  m_open(false),
+  m_eof(false),
+  m_readReq(false)
+{
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+}
+
+void LoopbackTransport::deliver(const char* data, std::size_t size)
+{
+  if (!m_open) return;
+  m_inbound.insert(m_inbound.end(), data, data + size);
+  complete();
+}
+
+void LoopbackTransport::hangup()
+{
+  m_eof = true;
+  complete();
+}
+
+void LoopbackTransport::connect(ConnectCallback callback)
+{
+  m_open = true;
+  m_eof = false;
+  m_inbound.clear();
+  m_inHead = 0;
+  auto self(shared_from_this());
+  m_strand.post([self, callback]() { callback(std::string()); });
+}
+
+void LoopbackTransport::read(const boost::asio::mutable_buffers_1& buffer)
+{
+  m_readBuf = buffer;
+  m_readReq = true;
+  complete();
+}
+
+void LoopbackTransport::write(const std::vector<boost::asio::const_buffer>& buffers)
+{
+  std::size_t bytes = 0;
+  if (m_open)
+    for (auto& buffer: buffers)
+    {
+      std::size_t size = boost::asio::buffer_size(buffer);
+      m_peer(boost::asio::buffer_cast<const char*>(buffer), size);
+      bytes += size;
+    }
+  boost::system::error_code ec;
+  if (!m_open) ec = boost::asio::error::not_connected;
+  auto self(shared_from_this());
+  m_strand.post([this, self, ec, bytes]() { m_writeCb(ec, bytes); });
+}
+
+void LoopbackTransport::close()
+{
+  m_open = false;
+  complete();
+}
+
+void LoopbackTransport::complete()
+{
+  if (!m_readReq) return;
+  boost::system::error_code ec;
+  std::size_t bytes = 0;
+  if (!m_open) ec = boost::asio::error::operation_aborted;
+    else if (m_inHead < m_inbound.size())
+    {
+      bytes = std::min(boost::asio::buffer_size(m_readBuf),
+                       m_inbound.size() - m_inHead);
+      std::memcpy(boost::asio::buffer_cast<char*>(m_readBuf),
+                  m_inbound.data() + m_inHead, bytes);
+      m_inHead += bytes;
+      if (m_inHead == m_inbound.size())
+      {
+        m_inbound.clear();
+        m_inHead = 0;
+      }
+    }
+    else if (m_eof) ec = boost::asio::error::eof;
+    else return;
+  m_readReq = false;
+  auto self(shared_from_this());
+  m_strand.post([this, self, ec, bytes]() { m_readCb(ec, bytes); });
+}
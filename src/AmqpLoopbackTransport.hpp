@@ -0,0 +1,99 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "AmqpTransport.hpp"
+
+namespace amqp {
+
+///
+/// Транспорт без сокета, обмен в памяти процесса.
+
+/// Все, что передает соединение, синхронно отдается функции-собеседнику
+/// (peer), заданной в конструкторе. Собеседник, в свою очередь, передает
+/// данные соединению методом deliver(). Так путь ввода/вывода библиотеки
+/// можно прогонять в тестах и замерах производительности без брокера и без
+/// сетевого стека, например, с имитатором брокера в том же процессе.
+/// Обработчики завершения операций, как и в других транспортах, вызываются
+/// асинхронно через strand.
+///
+/// Экземпляр подставляется в amqp::Connector через
+/// ConnectionOptions::transportFactory. Методы deliver() и hangup()
+/// вызываются в контексте strand транспорта.
+///
+/// @author cycleg
+///
+class LoopbackTransport: public Transport
+{
+  public:
+    typedef std::function<void(const char* data, std::size_t size)>
+      PeerCallback; ///< Указатель на функцию-собеседника, получающую
+                    ///< переданные соединением данные.
+
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] strand Strand, через который вызываются обработчики.
+    /// @param [in] peer Функция-собеседник.
+    ///
+    LoopbackTransport(const boost::asio::io_service::strand& strand,
+                      PeerCallback peer);
+    ///
+    /// Деструктор.
+    ///
+    ~LoopbackTransport();
+
+    ///
+    /// Передать данные соединению от собеседника.
+    ///
+    /// @param [in] data Данные.
+    /// @param [in] size Размер данных.
+    ///
+    /// Данные копируются во внутренний буфер и отдаются ожидающей или
+    /// следующей операции приема.
+    ///
+    void deliver(const char* data, std::size_t size);
+    ///
+    /// Закрыть соединение со стороны собеседника.
+    ///
+    /// После того, как переданные ранее данные будут приняты, прием
+    /// завершается с ошибкой boost::asio::error::eof.
+    ///
+    void hangup();
+    ///
+    /// Соединение открыто.
+    ///
+    /// @return Открыто или нет.
+    ///
+    inline bool connected() const { return m_open; }
+    ///
+    /// Объем данных от собеседника, еще не принятых соединением.
+    ///
+    /// @return Число байтов.
+    ///
+    inline std::size_t pending() const { return m_inbound.size() - m_inHead; }
+
+    void connect(ConnectCallback callback) override;
+    void read(const boost::asio::mutable_buffers_1& buffer) override;
+    void write(const std::vector<boost::asio::const_buffer>& buffers) override;
+    void close() override;
+
+  private:
+    ///
+    /// Завершить ожидающую операцию приема, если для нее есть данные или
+    /// соединение закрыто.
+    ///
+    void complete();
+
+    PeerCallback m_peer; ///< Функция-собеседник.
+    std::vector<char> m_inbound; ///< Данные от собеседника, еще не принятые
+                                 ///< соединением.
+    std::size_t m_inHead; ///< Начало непринятых данных в m_inbound.
+    boost::asio::mutable_buffer m_readBuf; ///< Буфер ожидающей операции
+                                           ///< приема.
+    bool m_open, ///< Признак, что соединение открыто.
+         m_eof, ///< Признак, что собеседник закрыл соединение.
+         m_readReq; ///< Признак, что ожидается операция приема.
+};
+
+} // namespace amqp
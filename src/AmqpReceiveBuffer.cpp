@@ -0,0 +1,51 @@
+#include <cstring>
+#include "AmqpReceiveBuffer.hpp"
+
+using namespace amqp;
+
+ReceiveBuffer::ReceiveBuffer():
+  m_capacity(0),
+  m_begin(0),
+  m_end(0),
+  m_copied(0)
+{
+}
+
+boost::asio::mutable_buffers_1 ReceiveBuffer::prepare(std::size_t size)
+{
+  if (m_capacity - m_end < size)
+  {
+    std::size_t remain = m_end - m_begin;
+    if (m_capacity - remain < size)
+      {
+        // the partial frame doesn't fit, grow the block
+        std::size_t capacity = m_capacity ? m_capacity : 2 * size;
+        while (capacity - remain < size) capacity *= 2;
+        std::unique_ptr<char[]> data(new char[capacity]);
+        if (remain) std::memcpy(data.get(), m_data.get() + m_begin, remain);
+        m_data.swap(data);
+        m_capacity = capacity;
+      }
+      // move the partial frame to the beginning of the block
+      else if (remain) std::memmove(m_data.get(), m_data.get() + m_begin, remain);
+    m_copied += remain;
+    m_begin = 0;
+    m_end = remain;
+  }
+  return boost::asio::buffer(m_data.get() + m_end, size);
+}
+
+void ReceiveBuffer::consume(std::size_t bytes)
+{
+  m_begin += bytes;
+  if (m_begin >= m_end) m_begin = m_end = 0;
+}
+
+void ReceiveBuffer::shrink(std::size_t capacity)
+{
+  if ((m_begin != m_end) || (m_capacity <= capacity)) return;
+  std::unique_ptr<char[]> data(capacity ? new char[capacity] : nullptr);
+  m_data.swap(data);
+  m_capacity = capacity;
+  m_begin = m_end = 0;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <boost/asio/buffer.hpp>
+
+namespace amqp {
+
+///
+/// Непрерывный буфер входящих данных.
+
+/// Буфер хранит принятые, но еще не разобранные AMQP-CPP данные одним
+/// непрерывным блоком памяти, поэтому разбор производится прямо в буфере,
+/// без промежуточного копирования. Новые данные принимаются в свободную часть
+/// блока за последним принятым байтом.
+///
+/// Разобранные данные отбрасываются сдвигом начала, а не перемещением
+/// остатка. Если после разбора в буфере ничего не осталось, запись снова
+/// начинается с начала блока. Незавершенный кадр переносится в начало блока
+/// (или в новый, больший блок) только тогда, когда за ним не хватает места
+/// для очередного приема. Число перенесенных таким образом байтов
+/// подсчитывается, см. copied().
+///
+/// Память блока не освобождается ни в consume(), ни в clear(): AMQP-CPP
+/// может закрыть соединение прямо во время разбора буфера. Уменьшить блок
+/// можно только явно, вызовом shrink() вне разбора.
+///
+/// @author cycleg
+///
+class ReceiveBuffer
+{
+  public:
+    ///
+    /// Конструктор.
+    ///
+    /// Память под буфер выделяется при первом вызове prepare().
+    ///
+    ReceiveBuffer();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    ReceiveBuffer(const ReceiveBuffer&) = delete;
+
+    ///
+    /// Начало неразобранных данных.
+    ///
+    /// @return Указатель на первый неразобранный байт.
+    ///
+    inline const char* data() const { return m_data.get() + m_begin; }
+    ///
+    /// Объем неразобранных данных.
+    ///
+    /// @return Число байтов.
+    ///
+    inline std::size_t size() const { return m_end - m_begin; }
+    ///
+    /// Размер выделенного блока памяти.
+    ///
+    /// @return Число байтов.
+    ///
+    inline std::size_t capacity() const { return m_capacity; }
+    ///
+    /// Весь блок памяти.
+    ///
+    /// @return Буфер, описывающий блок. Меняется только при росте блока.
+    ///
+    inline boost::asio::mutable_buffer storage() const
+    { return boost::asio::mutable_buffer(m_data.get(), m_capacity); }
+    ///
+    /// Число байтов, перенесенных внутри буфера.
+    ///
+    /// @return Суммарный объем копирования с момента создания буфера.
+    ///
+    inline uint64_t copied() const { return m_copied; }
+
+    ///
+    /// Подготовить место для приема данных.
+    ///
+    /// @param [in] size Желаемый объем приема.
+    /// @return Буфер для асинхронной операции приема.
+    ///
+    /// Если за последним принятым байтом не хватает места, неразобранный
+    /// остаток переносится в начало блока, а если не хватает и всего блока --
+    /// выделяется новый, вдвое больший.
+    ///
+    boost::asio::mutable_buffers_1 prepare(std::size_t size);
+    ///
+    /// Зафиксировать принятые данные.
+    ///
+    /// @param [in] bytes Число принятых байтов.
+    ///
+    inline void commit(std::size_t bytes) { m_end += bytes; }
+    ///
+    /// Отбросить разобранные данные.
+    ///
+    /// @param [in] bytes Число разобранных байтов.
+    ///
+    void consume(std::size_t bytes);
+    ///
+    /// Отбросить все данные.
+    ///
+    /// Выделенная память сохраняется.
+    ///
+    inline void clear() { m_begin = m_end = 0; }
+    ///
+    /// Уменьшить блок памяти.
+    ///
+    /// @param [in] capacity Новый размер блока.
+    ///
+    /// Блок заменяется меньшим, только если в буфере нет неразобранных
+    /// данных и текущий блок больше заданного размера.
+    ///
+    void shrink(std::size_t capacity);
+
+  private:
+    std::unique_ptr<char[]> m_data; ///< Блок памяти.
+    std::size_t m_capacity, ///< Размер блока памяти.
+                m_begin, ///< Смещение первого неразобранного байта.
+                m_end; ///< Смещение за последним принятым байтом.
+    uint64_t m_copied; ///< Счетчик перенесенных байтов.
+};
+
+} // namespace amqp
@@ -0,0 +1,87 @@
+#ifndef NDEBUG
+#include <iostream>
+#endif
+#include "AmqpResolverCache.hpp"
+
+using namespace amqp;
+
+std::shared_ptr<ResolverCache> ResolverCache::Global()
+{
+  static std::shared_ptr<ResolverCache> cache(std::make_shared<ResolverCache>());
+  return cache;
+}
+
+ResolverCache::ResolverCache()
+{
+}
+
+bool ResolverCache::lookup(const std::string& host, const std::string& port,
+                           Endpoints& endpoints) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_entries.find(host + ":" + port);
+  if ((i == m_entries.end()) || i->second.endpoints.empty() ||
+      (i->second.expires <= std::chrono::steady_clock::now()))
+    return false;
+  endpoints = i->second.endpoints;
+  return true;
+}
+
+void ResolverCache::resolve(boost::asio::io_service& service,
+                            const std::string& host, const std::string& port,
+                            unsigned ttl, ResolveCallback callback)
+{
+  std::string key(host + ":" + port);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry& entry = m_entries[key];
+    if (callback) entry.waiting.push_back(callback);
+    if (entry.resolving) return;
+    entry.resolving = true;
+  }
+#ifndef NDEBUG
+std::clog << "ResolverCache::resolve() " << key << std::endl;
+#endif
+  auto self(shared_from_this());
+  auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(service);
+  resolver->async_resolve(
+    boost::asio::ip::tcp::resolver::query(host, port),
+    [this, self, resolver, key, ttl](const boost::system::error_code& ec,
+                                     boost::asio::ip::tcp::resolver::iterator i) {
+      Endpoints endpoints;
+      if (!ec)
+        for (; i != boost::asio::ip::tcp::resolver::iterator(); ++i)
+          endpoints.push_back(i->endpoint());
+      boost::system::error_code error;
+      std::vector<ResolveCallback> waiting;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Entry& entry = m_entries[key];
+        entry.resolving = false;
+        entry.waiting.swap(waiting);
+        if (!endpoints.empty())
+        {
+          entry.endpoints = endpoints;
+          entry.expires = std::chrono::steady_clock::now() +
+                          std::chrono::seconds(ttl);
+        }
+        // a failed lookup keeps and hands out the old addresses
+        else if (!entry.endpoints.empty()) endpoints = entry.endpoints;
+        // nothing to connect to, an empty answer is an error too
+        else error = ec ? ec : boost::asio::error::host_not_found;
+      }
+#ifndef NDEBUG
+if (ec) std::clog << "ResolverCache::resolve() " << key << ": " << ec.message() << std::endl;
+#endif
+      for (auto& callback: waiting) callback(error, endpoints);
+    }
+  );
+}
+
+void ResolverCache::forget(const std::string& host, const std::string& port)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto i = m_entries.find(host + ":" + port);
+  if ((i == m_entries.end()) || i->second.resolving) return;
+  m_entries.erase(i);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace amqp {
+
+///
+/// Кэш разрешения имен брокеров.
+
+/// Хранит адреса, полученные при разрешении пары "хост, порт", в течение
+/// заданного времени жизни. Кэш общий для всех соединений, которые его
+/// используют (по умолчанию -- один на процесс, см. Global()), поэтому
+/// переподключения и соединения пула не разрешают имя брокера заново.
+/// Записи можно обновлять в фоне, например, пока amqp::AutoReconnect
+/// выжидает паузу перед очередной попыткой соединиться.
+///
+/// Методы класса потокобезопасны.
+///
+/// @author cycleg
+///
+class ResolverCache: public std::enable_shared_from_this<ResolverCache>
+{
+  public:
+    ///
+    /// Список адресов.
+    ///
+    typedef std::vector<boost::asio::ip::tcp::endpoint> Endpoints;
+    ///
+    /// Указатель на функцию, вызываемую по завершении разрешения имени.
+    ///
+    /// @param [in] ec Код ошибки.
+    /// @param [in] endpoints Адреса.
+    ///
+    typedef std::function<void(const boost::system::error_code& ec,
+                               const Endpoints& endpoints)> ResolveCallback;
+
+    ///
+    /// Общий кэш процесса.
+    ///
+    /// @return Указатель на кэш.
+    ///
+    static std::shared_ptr<ResolverCache> Global();
+
+    ///
+    /// Конструктор.
+    ///
+    ResolverCache();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    ResolverCache(const ResolverCache&) = delete;
+
+    ///
+    /// Найти действующую запись.
+    ///
+    /// @param [in] host Имя хоста.
+    /// @param [in] port Порт.
+    /// @param [out] endpoints Адреса из записи.
+    /// @return true, если запись есть и ее время жизни не истекло.
+    ///
+    bool lookup(const std::string& host, const std::string& port,
+                Endpoints& endpoints) const;
+    ///
+    /// Разрешить имя асинхронно и сохранить результат.
+    ///
+    /// @param [in] service Служба ввода/вывода.
+    /// @param [in] host Имя хоста.
+    /// @param [in] port Порт.
+    /// @param [in] ttl Время жизни записи (с).
+    /// @param [in] callback Обработчик результата (необязательный).
+    ///
+    /// Одновременные запросы одной пары "хост, порт" объединяются: имя
+    /// разрешается один раз, результат получают все обработчики. Если
+    /// разрешить имя не удалось, обработчики получают прежние адреса из
+    /// записи без ошибки, а если их нет -- код ошибки и пустой список.
+    ///
+    void resolve(boost::asio::io_service& service, const std::string& host,
+                 const std::string& port, unsigned ttl,
+                 ResolveCallback callback = nullptr);
+    ///
+    /// Удалить запись.
+    ///
+    /// @param [in] host Имя хоста.
+    /// @param [in] port Порт.
+    ///
+    /// Вызывается, если ни к одному адресу из записи не удалось подключиться.
+    ///
+    void forget(const std::string& host, const std::string& port);
+
+  private:
+    ///
+    /// Запись кэша.
+    ///
+    struct Entry
+    {
+      Endpoints endpoints; ///< Адреса.
+      std::chrono::steady_clock::time_point expires; ///< Момент истечения
+                                                     ///< времени жизни.
+      std::vector<ResolveCallback> waiting; ///< Обработчики незавершенного
+                                            ///< разрешения.
+      bool resolving = false; ///< Признак, что идет разрешение.
+    };
+
+    mutable std::mutex m_mutex; ///< Защита записей.
+    std::map<std::string, Entry> m_entries; ///< Записи по ключу
+                                            ///< "хост:порт".
+};
+
+} // namespace amqp
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#ifndef NDEBUG
+#include <iostream>
+#endif
+#include <boost/asio/ssl/rfc2818_verification.hpp>
+#include <boost/asio/write.hpp>
+#include "AmqpTcpTransport.hpp"
+
+using namespace amqp;
+
+TcpTransport::TcpTransport(boost::asio::io_service& service,
+                           const boost::asio::io_service::strand& strand,
+                           const std::string& host, const std::string& port,
+                           const ConnectionOptions& options,
+                           std::shared_ptr<TlsContext> tls):
+  Transport(strand),
+  m_service(service),
+  m_socket(service),
+  m_resolver(options.resolverCache ? options.resolverCache
+                                   : ResolverCache::Global()),
+  m_dnsTtl(options.dnsTtl),
+  m_stagger(options.connectStagger),
+  m_tls(tls),
+  m_connectCb(nullptr),
+  m_next(0),
+  m_staggerTimer(service),
+  m_closed(false),
+  m_host(host),
+  m_port(port)
+{
+}
+
+TcpTransport::~TcpTransport()
+{
+  // asynchronous operations hold the instance, so none of them is pending
+  boost::system::error_code ec;
+  m_socket.close(ec);
+}
+
+void TcpTransport::connect(ConnectCallback callback)
+{
+#ifndef NDEBUG
+std::clog << "TcpTransport::connect() " << m_host << ":" << m_port << std::endl;
+#endif
+  m_connectCb = callback;
+  m_closed = false;
+  auto self(shared_from_this());
+  ResolverCache::Endpoints endpoints;
+  if (m_resolver->lookup(m_host, m_port, endpoints))
+  {
+    // the callback is never called from connect() itself
+    m_strand.post([this, self, endpoints]() { race(endpoints); });
+    return;
+  }
+  m_resolver->resolve(m_service, m_host, m_port, m_dnsTtl,
+    m_strand.wrap([this, self](const boost::system::error_code& ec,
+                               const ResolverCache::Endpoints& endpoints) {
+      if (ec || endpoints.empty())
+      {
+        finish("failed to resolve: " + ec.message());
+        return;
+      }
+      race(endpoints);
+    })
+  );
+}
+
+void TcpTransport::race(const ResolverCache::Endpoints& endpoints)
+{
+  if (m_closed)
+  {
+    finish("failed to connect: " +
+      boost::asio::error::make_error_code(boost::asio::error::operation_aborted).message());
+    return;
+  }
+  // address families alternate, the first resolved one goes first
+  ResolverCache::Endpoints preferred, other;
+  for (const auto& endpoint: endpoints)
+    if (endpoint.address().is_v6() == endpoints.front().address().is_v6())
+      preferred.push_back(endpoint);
+      else other.push_back(endpoint);
+  m_endpoints.clear();
+  for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+  {
+    if (i < preferred.size()) m_endpoints.push_back(preferred[i]);
+    if (i < other.size()) m_endpoints.push_back(other[i]);
+  }
+  m_next = 0;
+  m_connectError.clear();
+  attempt();
+}
+
+void TcpTransport::attempt()
+{
+  auto socket = std::make_shared<boost::asio::ip::tcp::socket>(m_service);
+  const auto& endpoint = m_endpoints[m_next++];
+#ifndef NDEBUG
+std::clog << "TcpTransport::attempt() " << endpoint << std::endl;
+#endif
+  m_attempts.push_back(socket);
+  auto self(shared_from_this());
+  socket->async_connect(endpoint,
+    m_strand.wrap([this, self, socket](const boost::system::error_code& ec) {
+      auto i = std::find(m_attempts.begin(), m_attempts.end(), socket);
+      // another attempt has won
+      if (i == m_attempts.end()) return;
+      if (!ec)
+      {
+        m_staggerTimer.cancel();
+        m_socket = std::move(*socket);
+        // the losers are aborted and ignored
+        boost::system::error_code ignored;
+        for (auto& other: m_attempts) other->close(ignored);
+        m_attempts.clear();
+        if (m_tls) handshake();
+          else finish(std::string());
+        return;
+      }
+      m_attempts.erase(i);
+      m_connectError = ec.message();
+      // a failed address doesn't wait for the stagger
+      if (!m_closed && (m_next < m_endpoints.size())) attempt();
+        else if (m_attempts.empty())
+        {
+          // the addresses may be stale
+          if (!m_closed) m_resolver->forget(m_host, m_port);
+          finish("failed to connect: " + m_connectError);
+        }
+    })
+  );
+  if (m_next < m_endpoints.size())
+  {
+    m_staggerTimer.expires_from_now(std::chrono::milliseconds(m_stagger));
+    m_staggerTimer.async_wait(
+      m_strand.wrap([this, self](const boost::system::error_code& ec) {
+        if (ec || m_closed || m_attempts.empty() ||
+            (m_next >= m_endpoints.size()))
+          return;
+        attempt();
+      })
+    );
+  }
+    else m_staggerTimer.cancel();
+}
+
+void TcpTransport::finish(const std::string& error)
+{
+  m_staggerTimer.cancel();
+  ConnectCallback callback(nullptr);
+  callback.swap(m_connectCb);
+  if (callback) callback(error);
+}
+
+void TcpTransport::handshake()
+{
+  // SSL object can't be reused, so the stream is new for every connection,
+  // but the session is taken from the cache
+  m_tlsStream.reset(
+    new boost::asio::ssl::stream<boost::asio::ip::tcp::socket&>(
+      m_socket, m_tls->context()
+    )
+  );
+  if (m_tls->verify_peer())
+    m_tlsStream->set_verify_callback(
+      boost::asio::ssl::rfc2818_verification(m_host)
+    );
+  m_tls->prepare(m_tlsStream->native_handle(), m_host);
+  auto self(shared_from_this());
+  m_tlsStream->async_handshake(boost::asio::ssl::stream_base::client,
+    m_strand.wrap([this, self](const boost::system::error_code& ec) {
+      if (ec)
+      {
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
+        finish("TLS handshake failed: " + ec.message());
+        return;
+      }
+      m_tls->handshaked(m_tlsStream->native_handle());
+      finish(std::string());
+    })
+  );
+}
+
+void TcpTransport::read(const boost::asio::mutable_buffers_1& buffer)
+{
+  auto self(shared_from_this());
+  auto handler = m_strand.wrap(
+    [this, self](const boost::system::error_code& ec, std::size_t bytes) {
+      m_readCb(ec, bytes);
+    }
+  );
+  if (m_tlsStream) m_tlsStream->async_read_some(buffer, handler);
+    else if (!readRegistered(m_socket, buffer, handler))
+      m_socket.async_read_some(buffer, handler);
+}
+
+void TcpTransport::write(const std::vector<boost::asio::const_buffer>& buffers)
+{
+  auto self(shared_from_this());
+  auto handler = m_strand.wrap(
+    [this, self](const boost::system::error_code& ec, std::size_t bytes) {
+      m_writeCb(ec, bytes);
+    }
+  );
+  GatherBuffers gather = { &buffers };
+  // TLS encrypts the batch record by record, the gather list is kept
+  if (m_tlsStream) boost::asio::async_write(*m_tlsStream, gather, handler);
+    else boost::asio::async_write(m_socket, gather, handler);
+}
+
+void TcpTransport::close()
+{
+  // if connection close by other side, the underlying descriptor already
+  // closed, errors are ignored
+  boost::system::error_code ec;
+  m_closed = true;
+  // pending attempts complete with operation_aborted
+  m_staggerTimer.cancel();
+  for (auto& socket: m_attempts) socket->close(ec);
+  // TLS close_notify is not sent: AMQP connection is already closed (or
+  // lost), so the TCP connection is just dropped
+  if (m_tlsStream) m_tls->release(m_tlsStream->native_handle());
+  m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  // closing cancels outstanding operations
+  m_socket.close(ec);
+}
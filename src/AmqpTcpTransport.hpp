@@ -0,0 +1,108 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "AmqpConnectionOptions.hpp"
+#include "AmqpResolverCache.hpp"
+#include "AmqpTlsContext.hpp"
+#include "AmqpTransport.hpp"
+
+namespace amqp {
+
+///
+/// Транспорт TCP, в том числе с TLS.
+
+/// Подключение включает разрешение имени хоста брокера, установление
+/// TCP-соединения и, если задан контекст TLS (URL amqps://), рукопожатие
+/// TLS. Поток TLS создается заново для каждого соединения, сессия TLS
+/// берется из кэша контекста (см. TlsContext).
+///
+/// Адреса брокера берутся из кэша разрешения имен (см. ResolverCache), имя
+/// разрешается, только если в кэше нет действующей записи. К адресам
+/// подключение идет параллельно, со сдвигом по времени (happy eyeballs,
+/// RFC 8305): адреса IPv6 и IPv4 чередуются, подключение к следующему
+/// начинается через ConnectionOptions::connectStagger мс или сразу после
+/// неудачи предыдущего. Соединение, установленное первым, используется,
+/// остальные закрываются. Поэтому недоступный первый адрес не задерживает
+/// подключение на полный таймаут TCP.
+///
+/// @author cycleg
+///
+class TcpTransport: public Transport
+{
+  public:
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] service Ссылка на экземпляр службы ввода/вывода.
+    /// @param [in] strand Strand, через который вызываются обработчики.
+    /// @param [in] host Имя или адрес хоста брокера AMQP.
+    /// @param [in] port TCP-порт брокера AMQP.
+    /// @param [in] options Параметры соединения (используются кэш
+    ///                     разрешения имен, время жизни записей в нем и
+    ///                     пауза между попытками подключения).
+    /// @param [in] tls Контекст TLS (необязательный). Если не задан,
+    ///                 соединение не шифруется.
+    ///
+    TcpTransport(boost::asio::io_service& service,
+                 const boost::asio::io_service::strand& strand,
+                 const std::string& host, const std::string& port,
+                 const ConnectionOptions& options,
+                 std::shared_ptr<TlsContext> tls = nullptr);
+    ///
+    /// Деструктор.
+    ///
+    ~TcpTransport();
+
+    void connect(ConnectCallback callback) override;
+    void read(const boost::asio::mutable_buffers_1& buffer) override;
+    void write(const std::vector<boost::asio::const_buffer>& buffers) override;
+    void close() override;
+
+  private:
+    ///
+    /// Начать подключение к адресам брокера.
+    ///
+    /// @param [in] endpoints Адреса брокера.
+    ///
+    void race(const ResolverCache::Endpoints& endpoints);
+    ///
+    /// Начать подключение к следующему адресу.
+    ///
+    void attempt();
+    ///
+    /// Завершить подключение.
+    ///
+    /// @param [in] error Описание ошибки, пустая строка -- успех.
+    ///
+    void finish(const std::string& error);
+    ///
+    /// Выполнить рукопожатие TLS.
+    ///
+    void handshake();
+
+    boost::asio::io_service& m_service; ///< Служба ввода/вывода.
+    boost::asio::ip::tcp::socket m_socket; ///< Сокет соединения с брокером.
+    std::shared_ptr<ResolverCache> m_resolver; ///< Кэш разрешения имен.
+    unsigned m_dnsTtl, ///< Время жизни (с) записи в кэше.
+             m_stagger; ///< Пауза (мс) между попытками подключения.
+    std::shared_ptr<TlsContext> m_tls; ///< Контекст TLS.
+    ConnectCallback m_connectCb; ///< Обработчик завершения подключения.
+    ResolverCache::Endpoints m_endpoints; ///< Адреса в порядке попыток.
+    std::size_t m_next; ///< Индекс следующего адреса.
+    std::vector< std::shared_ptr<boost::asio::ip::tcp::socket> >
+      m_attempts; ///< Сокеты незавершенных попыток подключения.
+    boost::asio::steady_timer m_staggerTimer; ///< Таймер следующей попытки.
+    std::string m_connectError; ///< Последняя ошибка подключения.
+    bool m_closed; ///< Признак, что вызван close().
+    std::unique_ptr< boost::asio::ssl::stream<boost::asio::ip::tcp::socket&> >
+      m_tlsStream; ///< Поток TLS поверх m_socket.
+    std::string m_host, ///< Имя или адрес хоста брокера.
+                m_port; ///< TCP-порт брокера.
+};
+
+} // namespace amqp
@@ -0,0 +1,93 @@
+#ifndef NDEBUG
+#include <iostream>
+#endif
+#include "AmqpTlsContext.hpp"
+
+using namespace amqp;
+
+namespace {
+
+///
+/// Индекс ссылки на TlsContext в дополнительных данных SSL_CTX.
+///
+/// Данные приложения (индекс 0) заняты boost::asio::ssl::context.
+///
+int ContextIndex()
+{
+  static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr,
+                                              nullptr);
+  return index;
+}
+
+} // namespace
+
+TlsContext::TlsContext(const ConnectionOptions& options):
+  m_context(boost::asio::ssl::context::sslv23_client),
+  m_verifyPeer(options.tlsVerifyPeer),
+  m_session(nullptr),
+  m_resumed(0)
+{
+  m_context.set_options(boost::asio::ssl::context::default_workarounds |
+                        boost::asio::ssl::context::no_sslv2 |
+                        boost::asio::ssl::context::no_sslv3);
+  if (options.tlsCaFile.empty()) m_context.set_default_verify_paths();
+    else m_context.load_verify_file(options.tlsCaFile);
+  if (!options.tlsCertFile.empty())
+    m_context.use_certificate_chain_file(options.tlsCertFile);
+  if (!options.tlsKeyFile.empty())
+    m_context.use_private_key_file(options.tlsKeyFile,
+                                   boost::asio::ssl::context::pem);
+  m_context.set_verify_mode(m_verifyPeer ? boost::asio::ssl::verify_peer
+                                         : boost::asio::ssl::verify_none);
+  // the sessions are kept here, not in the OpenSSL internal store, because
+  // TLS 1.3 tickets arrive after the handshake
+  SSL_CTX* ctx = m_context.native_handle();
+  SSL_CTX_set_ex_data(ctx, ContextIndex(), this);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                      SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, &TlsContext::onNewSession);
+}
+
+TlsContext::~TlsContext()
+{
+  if (m_session) SSL_SESSION_free(m_session);
+}
+
+void TlsContext::prepare(SSL* ssl, const std::string& host)
+{
+  SSL_set_tlsext_host_name(ssl, host.c_str());
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_session) SSL_set_session(ssl, m_session);
+}
+
+void TlsContext::handshaked(SSL* ssl)
+{
+  if (!SSL_session_reused(ssl)) return;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_resumed;
+#ifndef NDEBUG
+std::clog << "TlsContext::handshaked() session resumed " << m_resumed << std::endl;
+#endif
+}
+
+void TlsContext::release(SSL* ssl)
+{
+  SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+}
+
+std::size_t TlsContext::resumed() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_resumed;
+}
+
+int TlsContext::onNewSession(SSL* ssl, SSL_SESSION* session)
+{
+  TlsContext* self = static_cast<TlsContext*>(
+    SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ContextIndex())
+  );
+  std::lock_guard<std::mutex> lock(self->m_mutex);
+  if (self->m_session) SSL_SESSION_free(self->m_session);
+  self->m_session = session;
+  return 1;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <boost/asio/ssl/context.hpp>
+#include "AmqpConnectionOptions.hpp"
+
+namespace amqp {
+
+///
+/// Контекст TLS для соединений amqps://.
+
+/// Содержит контекст OpenSSL, настроенный по параметрам ConnectionOptions
+/// (проверка сертификата брокера, корневые сертификаты, сертификат и ключ
+/// клиента), и кэш сессии TLS. Экземпляр принадлежит amqp::Connector и
+/// переживает все его переподключения, в том числе в цикле amqp::AutoReconnect.
+/// Сессия (или билет сессии, session ticket), выданная брокером при
+/// очередном рукопожатии, сохраняется, и следующее соединение предлагает ее
+/// брокеру. Если брокер ее принимает, рукопожатие сокращается и не требует
+/// обмена сертификатами и ключами.
+///
+/// Методы класса потокобезопасны.
+///
+/// @author cycleg
+///
+class TlsContext
+{
+  public:
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] options Параметры соединения.
+    ///
+    /// @throw boost::system::system_error Ошибка загрузки сертификатов или
+    ///        ключа.
+    ///
+    TlsContext(const ConnectionOptions& options);
+    ///
+    /// Деструктор.
+    ///
+    ~TlsContext();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    TlsContext(const TlsContext&) = delete;
+
+    ///
+    /// Получить контекст boost::asio для создания потоков TLS.
+    ///
+    /// @return Ссылка на контекст.
+    ///
+    inline boost::asio::ssl::context& context() { return m_context; }
+    ///
+    /// Проверять ли сертификат брокера.
+    ///
+    /// @return Проверять или нет.
+    ///
+    inline bool verify_peer() const { return m_verifyPeer; }
+
+    ///
+    /// Подготовить соединение TLS к рукопожатию.
+    ///
+    /// @param [in] ssl Соединение OpenSSL.
+    /// @param [in] host Имя хоста брокера.
+    ///
+    /// Задает имя хоста для SNI и предлагает брокеру сохраненную сессию,
+    /// если она есть.
+    ///
+    void prepare(SSL* ssl, const std::string& host);
+    ///
+    /// Учесть завершенное рукопожатие.
+    ///
+    /// @param [in] ssl Соединение OpenSSL.
+    ///
+    void handshaked(SSL* ssl);
+    ///
+    /// Учесть закрытие соединения TLS.
+    ///
+    /// @param [in] ssl Соединение OpenSSL.
+    ///
+    /// Соединение AMQP закрывается без обмена close_notify. Чтобы OpenSSL не
+    /// объявил при этом сохраненную сессию непригодной для возобновления,
+    /// соединение помечается как штатно закрытое.
+    ///
+    void release(SSL* ssl);
+    ///
+    /// Число рукопожатий, в которых сессия была возобновлена.
+    ///
+    /// @return Число возобновленных сессий.
+    ///
+    std::size_t resumed() const;
+
+  private:
+    ///
+    /// Обратный вызов OpenSSL при получении новой сессии от брокера.
+    ///
+    /// @param [in] ssl Соединение OpenSSL.
+    /// @param [in] session Новая сессия.
+    /// @return 1 -- сессия сохранена, ссылка на нее удерживается.
+    ///
+    static int onNewSession(SSL* ssl, SSL_SESSION* session);
+
+    boost::asio::ssl::context m_context; ///< Контекст TLS.
+    bool m_verifyPeer; ///< Проверять ли сертификат брокера.
+    mutable std::mutex m_mutex; ///< Защита кэша сессии.
+    SSL_SESSION* m_session; ///< Последняя полученная сессия.
+    std::size_t m_resumed; ///< Число возобновленных сессий.
+};
+
+} // namespace amqp
@@ -0,0 +1,247 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "AmqpTrace.hpp"
+
+using namespace amqp;
+
+namespace {
+
+///
+/// Кольцевой буфер записей одного потока.
+///
+/// Писатель -- поток-владелец, читатель -- Trace::Drain(), поэтому хватает
+/// двух атомарных индексов.
+///
+class Ring
+{
+  public:
+    static const std::size_t Capacity = 4096; ///< Число записей, степень 2.
+
+    explicit Ring(uint32_t thread):
+      m_thread(thread),
+      m_head(0),
+      m_tail(0),
+      m_dropped(0),
+      m_orphaned(false)
+    {
+    }
+
+    inline uint32_t thread() const { return m_thread; }
+    inline uint64_t dropped() const
+    { return m_dropped.load(std::memory_order_relaxed); }
+    inline bool orphaned() const
+    { return m_orphaned.load(std::memory_order_acquire); }
+    inline void orphan() { m_orphaned.store(true, std::memory_order_release); }
+
+    void push(const Trace::Entry& entry)
+    {
+      uint64_t head = m_head.load(std::memory_order_relaxed);
+      if (head - m_tail.load(std::memory_order_acquire) >= Capacity)
+      {
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+        return;
+      }
+      m_entries[head & (Capacity - 1)] = entry;
+      m_head.store(head + 1, std::memory_order_release);
+    }
+
+    bool pop(Trace::Entry& entry)
+    {
+      uint64_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail == m_head.load(std::memory_order_acquire)) return false;
+      entry = m_entries[tail & (Capacity - 1)];
+      m_tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    Trace::Entry m_entries[Capacity];
+    uint32_t m_thread;
+    std::atomic<uint64_t> m_head, m_tail, m_dropped;
+    std::atomic<bool> m_orphaned;
+};
+
+///
+/// Общее состояние трассировки.
+///
+struct Registry
+{
+  std::mutex mutex; // rings and sink
+  std::vector< std::shared_ptr<Ring> > rings;
+  uint32_t threads = 0;
+  uint64_t dropped = 0; // of removed rings
+  Trace::Sink sink = nullptr;
+  std::mutex drainMutex; // one Drain() at a time
+  std::mutex workerMutex;
+  std::condition_variable wakeup;
+  std::thread worker;
+  bool stopping = false;
+};
+
+Registry& GetRegistry()
+{
+  // never destroyed: threads may record while the process exits
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+///
+/// Владелец кольцевого буфера потока.
+///
+/// При завершении потока буфер помечается брошенным и удаляется из реестра
+/// после выгрузки.
+///
+struct RingHolder
+{
+  std::shared_ptr<Ring> ring;
+
+  ~RingHolder()
+  {
+    if (ring) ring->orphan();
+  }
+};
+
+thread_local RingHolder LocalRing;
+
+const char* EventNames[Trace::eEventCount] = {
+  "connect",
+  "shutdown",
+  "read",
+  "parse",
+  "data",
+  "flush",
+  "write",
+  "publish",
+  "read-size",
+  "return"
+};
+
+} // namespace
+
+void Trace::Record(Event event, const void* object, uint64_t a, uint64_t b)
+{
+  if (!LocalRing.ring)
+  {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    LocalRing.ring = std::make_shared<Ring>(registry.threads++);
+    registry.rings.push_back(LocalRing.ring);
+  }
+  Entry entry;
+  entry.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+  entry.object = object;
+  entry.a = a;
+  entry.b = b;
+  entry.thread = LocalRing.ring->thread();
+  entry.event = event;
+  LocalRing.ring->push(entry);
+}
+
+std::size_t Trace::Drain()
+{
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> drainLock(registry.drainMutex);
+  std::vector< std::shared_ptr<Ring> > rings;
+  Sink sink;
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    rings = registry.rings;
+    sink = registry.sink;
+  }
+  // the sink may trace too, so no registry lock is held while it runs
+  std::size_t count = 0;
+  Entry entry;
+  std::vector<Ring*> finished;
+  for (auto& ring: rings)
+  {
+    // the owner has exited, nothing is pushed after the check
+    bool orphaned = ring->orphaned();
+    while (ring->pop(entry))
+    {
+      if (sink) sink(entry);
+        else std::clog << Format(entry) << '\n';
+      ++count;
+    }
+    if (orphaned) finished.push_back(ring.get());
+  }
+  if (!finished.empty())
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (Ring* ring: finished)
+      for (auto i = registry.rings.begin(); i != registry.rings.end(); ++i)
+        if (i->get() == ring)
+        {
+          registry.dropped += ring->dropped();
+          registry.rings.erase(i);
+          break;
+        }
+  }
+  if (count && !sink) std::clog.flush();
+  return count;
+}
+
+void Trace::SetSink(Sink sink)
+{
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.sink = sink;
+}
+
+void Trace::Start(unsigned interval)
+{
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.workerMutex);
+  if (registry.worker.joinable()) return;
+  registry.stopping = false;
+  registry.worker = std::thread([&registry, interval]() {
+    std::unique_lock<std::mutex> lock(registry.workerMutex);
+    while (!registry.stopping)
+    {
+      registry.wakeup.wait_for(lock, std::chrono::milliseconds(interval));
+      lock.unlock();
+      Drain();
+      lock.lock();
+    }
+  });
+}
+
+void Trace::Stop()
+{
+  Registry& registry = GetRegistry();
+  {
+    std::lock_guard<std::mutex> lock(registry.workerMutex);
+    if (!registry.worker.joinable()) return;
+    registry.stopping = true;
+  }
+  registry.wakeup.notify_all();
+  registry.worker.join();
+  Drain();
+}
+
+uint64_t Trace::Dropped()
+{
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  uint64_t dropped = registry.dropped;
+  for (auto& ring: registry.rings) dropped += ring->dropped();
+  return dropped;
+}
+
+std::string Trace::Format(const Entry& entry)
+{
+  std::ostringstream out;
+  out << entry.time << " [" << entry.thread << "] "
+      << ((entry.event < eEventCount) ? EventNames[entry.event] : "?")
+      << ' ' << entry.object << ' ' << entry.a << ' ' << entry.b;
+  return out.str();
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+///
+/// Уровень трассировки, с которым собрана библиотека.
+///
+/// 0 -- трассировка выключена, 1 -- события жизненного цикла соединения,
+/// 2 -- также каждая операция ввода/вывода. Вызовы трассировки выше
+/// заданного уровня удаляются препроцессором вместе с вычислением
+/// аргументов. Задается опцией CMake AMQPASIO_TRACE_LEVEL.
+///
+#ifndef AMQPASIO_TRACE_LEVEL
+#define AMQPASIO_TRACE_LEVEL 0
+#endif
+
+#if AMQPASIO_TRACE_LEVEL >= 1
+#define AMQPASIO_TRACE_INFO(event, object, a, b) \
+  ::amqp::Trace::Record(::amqp::Trace::event, (object), uint64_t(a), uint64_t(b))
+#else
+#define AMQPASIO_TRACE_INFO(event, object, a, b) ((void)0)
+#endif
+
+#if AMQPASIO_TRACE_LEVEL >= 2
+#define AMQPASIO_TRACE_DEBUG(event, object, a, b) \
+  ::amqp::Trace::Record(::amqp::Trace::event, (object), uint64_t(a), uint64_t(b))
+#else
+#define AMQPASIO_TRACE_DEBUG(event, object, a, b) ((void)0)
+#endif
+
+namespace amqp {
+
+///
+/// Трассировка библиотеки.
+
+/// События записываются двоичными записями фиксированного размера в
+/// кольцевой буфер потока, вызвавшего Record(). Буфер у каждого потока свой,
+/// запись в него не требует блокировок: единственный читатель -- Drain().
+/// Если буфер заполнен, событие отбрасывается и учитывается в Dropped().
+///
+/// Форматирование вынесено из горячего пути: Drain() передает записи
+/// заданному обработчику (SetSink()), по умолчанию -- Format() в std::clog.
+/// Drain() вызывается приложением из любого потока или периодически из
+/// фонового потока, запущенного Start().
+///
+/// Методы класса потокобезопасны.
+///
+/// @author cycleg
+///
+class Trace
+{
+  public:
+    ///
+    /// События трассировки.
+    ///
+    enum Event: uint16_t
+    {
+      eConnect = 0, ///< Транспорт подключен (a -- 0, успех, или 1, ошибка).
+      eShutdown, ///< Соединение закрыто (a -- признак потери соединения).
+      eRead, ///< Прием завершен (a -- принято байтов, b -- в буфере).
+      eParse, ///< Разбор (a -- разобрано байтов, b -- осталось).
+      eData, ///< Кадр в очереди исходящих (a -- размер, b -- очередь, байт).
+      eFlush, ///< Начата групповая передача (a -- кадров, b -- байтов).
+      eWrite, ///< Передача завершена (a -- отправлено байтов, b -- кадров).
+      ePublish, ///< Публикация сообщения (a -- размер тела).
+      eReadSize, ///< Размер приема уменьшен (a -- новый размер, b -- принято байтов).
+      eReturn, ///< Сообщение возвращено брокером (a -- размер тела, b -- код).
+      eEventCount ///< Число событий.
+    };
+
+    ///
+    /// Запись трассировки.
+    ///
+    struct Entry
+    {
+      uint64_t time; ///< Время события (нс, steady_clock).
+      const void* object; ///< Объект, в котором произошло событие.
+      uint64_t a, ///< Первый параметр события.
+               b; ///< Второй параметр события.
+      uint32_t thread; ///< Номер потока (в порядке первой записи).
+      uint16_t event; ///< Событие, см. Event.
+    };
+
+    ///
+    /// Указатель на функцию, получающую записи при выгрузке.
+    ///
+    /// @param [in] entry Запись.
+    ///
+    typedef std::function<void(const Entry& entry)> Sink;
+
+    ///
+    /// Записать событие.
+    ///
+    /// @param [in] event Событие.
+    /// @param [in] object Объект, в котором произошло событие.
+    /// @param [in] a Первый параметр события.
+    /// @param [in] b Второй параметр события.
+    ///
+    /// Вызывается макросами AMQPASIO_TRACE_INFO() и AMQPASIO_TRACE_DEBUG().
+    ///
+    static void Record(Event event, const void* object, uint64_t a, uint64_t b);
+    ///
+    /// Выгрузить накопленные записи всех потоков.
+    ///
+    /// @return Число выгруженных записей.
+    ///
+    static std::size_t Drain();
+    ///
+    /// Задать обработчик выгружаемых записей.
+    ///
+    /// @param [in] sink Обработчик. nullptr -- вывод Format() в std::clog.
+    ///
+    static void SetSink(Sink sink);
+    ///
+    /// Запустить фоновую выгрузку записей.
+    ///
+    /// @param [in] interval Период выгрузки (мс).
+    ///
+    static void Start(unsigned interval = 100);
+    ///
+    /// Остановить фоновую выгрузку записей.
+    ///
+    /// Оставшиеся записи выгружаются.
+    ///
+    static void Stop();
+    ///
+    /// Число отброшенных записей.
+    ///
+    /// @return Сумма по всем потокам.
+    ///
+    static uint64_t Dropped();
+    ///
+    /// Отформатировать запись.
+    ///
+    /// @param [in] entry Запись.
+    /// @return Строка вида "время [поток] событие объект a b".
+    ///
+    static std::string Format(const Entry& entry);
+
+  private:
+    Trace() = delete;
+};
+
+} // namespace amqp
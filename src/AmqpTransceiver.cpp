@@ -1,7 +1,10 @@
 #ifndef NDEBUG
 #include <iostream>
 #endif
+#include <algorithm>
+#include <cmath>
 #include "AmqpJsonConverter.hpp"
+#include "AmqpTrace.hpp"
 #include "AmqpTransceiver.hpp"
 
 #define UNUSED(x) (void)x;
@@ -9,6 +12,7 @@
 using namespace amqp;
 
 const int Transceiver::ExchangeCreationFlags = AMQP::autodelete + AMQP::durable;
+const uint32_t Transceiver::MinWindow = 32;
 std::unordered_map<Transceiver::State, Transceiver::State> Transceiver::StopTransit = {
   { eCreateChannel, eEnd },
   { eCreateExchange, eCloseChannel },
@@ -32,6 +36,44 @@ Transceiver::Transceiver(const std::string& exchange, const std::string& queue_,
   m_onBounceMessage(nullptr),
   m_onMessage(nullptr),
   m_onExit(nullptr),
+  m_onDrain(nullptr),
+  m_startedCb(nullptr),
+  m_stoppedCb(nullptr),
+  m_writable(true),
+  m_refuseUnwritable(false),
+  m_confirms(false),
+  m_confirmWindow(0),
+  m_confirmMode(false),
+  m_stripeCount(1),
+  m_stripeMode(eRoundRobin),
+  m_nextStripe(0),
+  m_dispatch(0),
+  m_stripesPending(0),
+  m_stripesClosing(false),
+  m_prefetch(0),
+  m_prefetchMin(0),
+  m_prefetchMax(0),
+  m_prefetchCount(0),
+  m_held(0),
+  m_heldArea(0),
+  m_windowMessages(0),
+  m_lastThroughput(0),
+  m_lastHold(0),
+  m_lastCount(0),
+  m_climbing(false),
+  m_drift(0),
+  m_windowSkip(false),
+  m_generation(0),
+  m_ackMaxPending(0),
+  m_ackMaxDelay(0),
+  m_coalescing(false),
+  m_unsentAcks(0),
+  m_ackTimer(0),
+  m_flushRequested(false),
+  m_post(nullptr),
+  m_schedule(nullptr),
+  m_counters(nullptr),
+  m_cork(nullptr),
   m_ec(eNoError)
 {
   // если имя очереди не было задано, брокер удалит ее после закрытия канала
@@ -57,62 +99,169 @@ void Transceiver::onExit(ExitCallback callback)
   m_onExit = callback;
 }
 
+void Transceiver::onDrain(DrainCallback callback)
+{
+  m_onDrain = callback;
+}
+
+void Transceiver::enableConfirms(std::size_t window)
+{
+  m_confirms = true;
+  m_confirmWindow = window;
+}
+
+void Transceiver::stripeChannels(std::size_t count, StripeMode mode)
+{
+  m_stripeCount = std::max<std::size_t>(count, 1);
+  m_stripeMode = mode;
+}
+
+void Transceiver::prefetch(uint16_t count)
+{
+  m_prefetch = count;
+  m_prefetchMax = 0;
+}
+
+void Transceiver::adaptivePrefetch(uint16_t minCount, uint16_t maxCount)
+{
+  m_prefetchMin = std::max<uint16_t>(minCount, 1);
+  m_prefetchMax = std::max(maxCount, m_prefetchMin);
+}
+
+void Transceiver::coalesceAcks(std::size_t maxPending,
+                               std::chrono::microseconds maxDelay)
+{
+  m_ackMaxPending = maxPending;
+  m_ackMaxDelay = maxDelay;
+}
+
+bool Transceiver::ack(uint64_t deliveryTag, AMQP::Channel* channel)
+{
+  if (!Consuming()) return false;
+  Stripe* stripe = FindStripe(channel);
+  if (!stripe) return false;
+  if (!m_coalescing)
+  {
+    if (m_prefetchMax) AdaptPrefetch(false);
+    return stripe->channel->ack(deliveryTag);
+  }
+  if (deliveryTag <= stripe->ackFloor) return true; // already settled
+  if (deliveryTag - stripe->ackFloor > stripe->deliveries.size())
+    return false; // not delivered on this channel
+  Delivery& delivery = stripe->deliveries[deliveryTag - stripe->ackFloor - 1];
+  if (delivery != ePending) return true;
+  delivery = eCompleted;
+  if (m_prefetchMax) AdaptPrefetch(false);
+  ++stripe->unsentAcks;
+  bool timed = m_ackMaxDelay.count() && m_schedule;
+  if (!m_unsentAcks++ && timed)
+  {
+    // the first pending ack arms the timer, a flush on count leaves it
+    // running and the next batch arms a new one
+    uint64_t timer = ++m_ackTimer;
+    m_schedule(m_ackMaxDelay, [timer](Transceiver& transceiver) {
+      if (transceiver.m_ackTimer == timer) transceiver.flushAcks();
+    });
+  }
+  if ((m_unsentAcks >= m_ackMaxPending) || (!timed && !m_post))
+    flushAcks();
+    else if (!timed && !m_flushRequested)
+    {
+      // flush once the running handler of the connector is done
+      m_flushRequested = true;
+      m_post([](Transceiver& transceiver) { transceiver.flushAcks(); });
+    }
+  return true;
+}
+
+bool Transceiver::reject(uint64_t deliveryTag, bool requeue,
+                         AMQP::Channel* channel)
+{
+  if (!Consuming()) return false;
+  Stripe* stripe = FindStripe(channel);
+  if (!stripe) return false;
+  if (m_coalescing && (deliveryTag > stripe->ackFloor) &&
+      (deliveryTag - stripe->ackFloor <= stripe->deliveries.size()))
+  {
+    Delivery& delivery = stripe->deliveries[deliveryTag - stripe->ackFloor - 1];
+    if (delivery != ePending) return true;
+    delivery = eSettled;
+  }
+  if (m_prefetchMax) AdaptPrefetch(false);
+  return stripe->channel->reject(deliveryTag, requeue ? AMQP::requeue : 0);
+}
+
+AckHandle Transceiver::ackHandle(uint64_t deliveryTag, AMQP::Channel* channel)
+{
+  if (!m_ackQueue) m_ackQueue = std::make_shared<AckQueue>(m_post);
+  Stripe* stripe = FindStripe(channel);
+  if (stripe) channel = stripe->channel.get();
+  return AckHandle(m_ackQueue, m_generation, channel, deliveryTag);
+}
+
+void Transceiver::flushAcks()
+{
+  m_flushRequested = false;
+  for (auto& stripe: m_stripes)
+  {
+    if (!m_unsentAcks) break;
+    if (!stripe.unsentAcks || !stripe.channel) continue;
+    // the settled head of the window: one "multiple" ack covers it
+    uint64_t last = 0;
+    std::size_t covered = 0;
+    while (!stripe.deliveries.empty() &&
+           (stripe.deliveries.front() != ePending))
+    {
+      ++stripe.ackFloor;
+      if (stripe.deliveries.front() == eCompleted)
+      {
+        last = stripe.ackFloor;
+        ++covered;
+      }
+      stripe.deliveries.pop_front();
+    }
+    if (covered) stripe.channel->ack(last, (covered > 1) ? AMQP::multiple : 0);
+    stripe.unsentAcks -= covered;
+    m_unsentAcks -= covered;
+    // "multiple" would cover the gap, so completions after it go one by one
+    for (std::size_t i = 0;
+         stripe.unsentAcks && (i < stripe.deliveries.size()); ++i)
+      if (stripe.deliveries[i] == eCompleted)
+      {
+        stripe.channel->ack(stripe.ackFloor + 1 + i);
+        stripe.deliveries[i] = eSettled;
+        --stripe.unsentAcks;
+        --m_unsentAcks;
+      }
+  }
+}
+
 bool Transceiver::send(const rapidjson::Document& message,
                        const std::string& route,
-                       bool mandatory)
+                       bool mandatory, ConfirmCallback confirmed)
 {
   if (m_state != eReady) return false;
-  int flags = 0;
-  if (mandatory) flags += AMQP::mandatory;
+  if (!m_writable && m_refuseUnwritable) return false;
+  if (windowFull()) return false;
   // AMQP::Envelope don't owned message body, so we provide the buffer.
   std::string buffer;
   std::shared_ptr< AMQP::Envelope > envelope(ConvertFromJson(message, buffer));
-#ifndef NDEBUG
-std::clog << "Transceiver send " << buffer << std::endl;
-#endif
-  m_channel->publish(m_exchange, route, *envelope, flags)
-    .onReturned([this](const AMQP::Message& message, int16_t code,
-                       const std::string& description) {
-#ifndef NDEBUG
-std::clog << "DefferedPublisher:: onReturned()" << std::endl;
-#endif
-      if (this->m_onBounceMessage)
-      {
-#ifndef NDEBUG
-std::clog << "DefferedPublisher:: onReturned() do callback" << std::endl;
-#endif
-        this->m_onBounceMessage(message, code, description);
-      }
-    });
+  publish(*envelope, route, mandatory ? AMQP::mandatory : 0, confirmed);
+  if (m_counters) ConnectionCounters::Add(m_counters->published);
   return true;
 }
 
 bool Transceiver::send(const std::string& message, const std::string& route,
-                       bool mandatory)
+                       bool mandatory, ConfirmCallback confirmed)
 {
   if (m_state != eReady) return false;
-  int flags = 0;
-  if (mandatory) flags += AMQP::mandatory;
+  if (!m_writable && m_refuseUnwritable) return false;
+  if (windowFull()) return false;
   AMQP::Envelope envelope(message.data(), message.size());
   envelope.setContentType("text/plain");
   envelope.setContentEncoding("utf-8");
-#ifndef NDEBUG
-std::clog << "Transceiver send " << message << std::endl;
-#endif
-  m_channel->publish(m_exchange, route, envelope, flags)
-    .onReturned([this](const AMQP::Message& message, int16_t code,
-                       const std::string& description) {
-#ifndef NDEBUG
-std::clog << "DefferedPublisher:: onReturned()" << std::endl;
-#endif
-      if (this->m_onBounceMessage)
-      {
-#ifndef NDEBUG
-std::clog << "DefferedPublisher:: onReturned() do callback" << std::endl;
-#endif
-        this->m_onBounceMessage(message, code, description);
-      }
-    });
+  publish(envelope, route, mandatory ? AMQP::mandatory : 0, confirmed);
+  if (m_counters) ConnectionCounters::Add(m_counters->published);
   return true;
 }
 
@@ -125,24 +274,50 @@ void Transceiver::OnMessage(AMQP::Channel* channel, const AMQP::Message& message
   UNUSED(redelivered)
 }
 
-void Transceiver::start(AMQP::Connection* connection)
+void Transceiver::start(AMQP::Connection* connection, DoneCallback callback)
 {
   if (m_state == eEnd)
-  {
-    m_connection = connection;
-    m_error.clear();
-    m_ec = eNoError;
-    m_state = eCreateChannel;
+    {
+      m_connection = connection;
+      m_error.clear();
+      m_ec = eNoError;
+      m_startedCb = callback;
+      m_state = eCreateChannel;
 #ifndef NDEBUG
 std::clog << "Transceiver eEnd -> " << m_state << std::endl;
 #endif
-    StateMachine();
-  }
+      StateMachine();
+    }
+    else if (callback)
+    {
+      if (m_state == eReady) callback();
+        else
+        {
+          // wait for the running procedure
+          DoneCallback previous(m_startedCb);
+          m_startedCb = [previous, callback]() {
+            if (previous) previous();
+            callback();
+          };
+        }
+    }
 }
 
-void Transceiver::stop()
+void Transceiver::stop(DoneCallback callback)
 {
-  if (m_state == eEnd) return;
+  if (m_state == eEnd)
+  {
+    if (callback) callback();
+    return;
+  }
+  if (callback)
+  {
+    DoneCallback previous(m_stoppedCb);
+    m_stoppedCb = [previous, callback]() {
+      if (previous) previous();
+      callback();
+    };
+  }
   if ((m_state >= eCreateChannel) && (m_state <= eReady))
   {
 #ifndef NDEBUG
@@ -166,6 +341,291 @@ void Transceiver::drop()
   StateMachine();
 }
 
+void Transceiver::setWritable(bool writable)
+{
+  if (m_writable == writable) return;
+  m_writable = writable;
+  if (this->writable() && m_onDrain) m_onDrain();
+}
+
+void Transceiver::publish(const AMQP::Envelope& envelope,
+                          const std::string& route, int flags,
+                          ConfirmCallback confirmed)
+{
+  AMQPASIO_TRACE_DEBUG(ePublish, this, envelope.bodySize(), 0);
+  Stripe& stripe = PickStripe(route);
+  AMQP::DeferredPublisher& publisher =
+    stripe.channel->publish(m_exchange, route, envelope, flags);
+  if (!stripe.returnsWatched)
+  {
+    watchReturns(publisher);
+    stripe.returnsWatched = true;
+  }
+  // the broker numbers publications of the channel from 1, in the same order
+  if (m_confirmMode) stripe.unconfirmed.push_back(Unconfirmed{confirmed, false});
+}
+
+Transceiver::Stripe& Transceiver::PickStripe(const std::string& route)
+{
+  if (m_stripes.size() == 1) return m_stripes.front();
+  std::size_t i = (m_stripeMode == eByRoute) ?
+    std::hash<std::string>()(route) : m_nextStripe++;
+  return m_stripes[i % m_stripes.size()];
+}
+
+Transceiver::Stripe* Transceiver::FindStripe(AMQP::Channel* channel)
+{
+  if (!channel)
+    return (m_dispatch < m_stripes.size()) ? &m_stripes[m_dispatch] : nullptr;
+  for (auto& stripe: m_stripes)
+    if (stripe.channel.get() == channel) return &stripe;
+  return nullptr;
+}
+
+void Transceiver::OpenStripes()
+{
+  m_stripes.clear();
+  m_stripes.resize(m_stripeCount);
+  m_stripes.front().channel = m_channel;
+  m_nextStripe = 0;
+  m_stripesPending = 0;
+  m_stripesClosing = false;
+  for (std::size_t i = 1; i < m_stripes.size(); ++i)
+  {
+    // AMQP-CPP holds the commands until the channel is open
+    m_stripes[i].channel = std::make_shared<AMQP::Channel>(m_connection);
+    m_stripes[i].channel->onError([this](const char* message) {
+#ifndef NDEBUG
+std::clog << "Transceiver stripe channel error: " << message << std::endl;
+#endif
+      // a lost channel takes the transceiver down, as the primary one does
+      if ((m_state < eCreateExchange) || (m_state > eReady)) return;
+      m_ec = (m_state == eReady) ? eChannelAbruptlyClosedError :
+        ((m_state == eCreateConsumer) ? eCreateConsumerError :
+                                        eCreateChannelError);
+      m_error = message;
+      // before eReady the transceiver stops in order, as on an error of the
+      // primary channel: the queue is unbound, the other channels are closed
+      m_state = (m_state == eReady) ? eEnd : StopTransit[m_state];
+#ifndef NDEBUG
+std::clog << "Transceiver stripe channel -> " << m_state << std::endl;
+#endif
+      StateMachine();
+    });
+  }
+  m_confirmMode = m_confirms;
+  if (!m_confirms) return;
+  // pipelined ahead of the exchange declaration, no extra round trip
+  for (std::size_t i = 0; i < m_stripes.size(); ++i)
+    m_stripes[i].channel->confirmSelect()
+      .onAck([this, i](uint64_t deliveryTag, bool multiple) {
+        OnConfirm(i, deliveryTag, multiple, true);
+      })
+      .onNack([this, i](uint64_t deliveryTag, bool multiple, bool requeue) {
+        UNUSED(requeue)
+        OnConfirm(i, deliveryTag, multiple, false);
+      });
+}
+
+void Transceiver::CloseStripes()
+{
+  if (m_stripesClosing) return;
+  m_stripesClosing = true;
+  m_stripesPending = 0;
+  for (std::size_t i = 1; i < m_stripes.size(); ++i)
+  {
+    if (!m_stripes[i].channel) continue;
+    ++m_stripesPending;
+    // a late answer of the previous session must not count
+    uint64_t generation = m_generation;
+    auto closed = [this, generation]() {
+      if (generation != m_generation) return;
+      if (m_stripesPending) --m_stripesPending;
+      if (m_stripesPending || (m_state != eCloseStripes)) return;
+      m_state = eEnd;
+#ifndef NDEBUG
+std::clog << "Transceiver eCloseStripes -> " << m_state << std::endl;
+#endif
+      StateMachine();
+    };
+    m_stripes[i].channel->close()
+      .onSuccess(closed)
+      .onError([closed](const char* message) {
+        UNUSED(message)
+        closed();
+      });
+  }
+}
+
+void Transceiver::OnConsumer()
+{
+  if ((m_state != eCreateConsumer) || (m_stripesPending && --m_stripesPending))
+    return;
+  m_state = eReady;
+#ifndef NDEBUG
+std::clog << "Transceiver eCreateConsumer(" << m_consumerTag << ") -> " << m_state << std::endl;
+#endif
+  StateMachine();
+}
+
+void Transceiver::Dispatch(std::size_t stripe, const AMQP::Message& message,
+                           uint64_t deliveryTag, bool redelivered)
+{
+  // PROCESS INCOMING MESSAGES
+  if (!Consuming()) return;
+  if (m_counters) ConnectionCounters::Add(m_counters->received);
+  if (m_coalescing) m_stripes[stripe].deliveries.push_back(ePending);
+  if (m_prefetchMax) AdaptPrefetch(true);
+  AMQP::Channel* channel = m_stripes[stripe].channel.get();
+  m_dispatch = stripe;
+  if (m_onMessage) m_onMessage(channel, message, deliveryTag, redelivered);
+    else OnMessage(channel, message, deliveryTag, redelivered);
+  m_dispatch = 0;
+}
+
+void Transceiver::watchReturns(AMQP::DeferredPublisher& publisher)
+{
+  publisher.onReturned([this](const AMQP::Message& message, int16_t code,
+                              const std::string& description) {
+    AMQPASIO_TRACE_DEBUG(eReturn, this, message.bodySize(), code);
+    if (this->m_onBounceMessage)
+      this->m_onBounceMessage(message, code, description);
+  });
+}
+
+void Transceiver::OnConfirm(std::size_t stripe, uint64_t deliveryTag,
+                            bool multiple, bool ack)
+{
+  // the vector is only resized at start, so the reference survives callbacks
+  Stripe& s = m_stripes[stripe];
+  if ((deliveryTag < s.confirmBase) ||
+      (deliveryTag - s.confirmBase >= s.unconfirmed.size()))
+    return; // already settled or unknown
+  bool full = windowFull();
+  if (multiple)
+    {
+      // the callbacks may publish, so each entry leaves the window first
+      while (!s.unconfirmed.empty() && (s.confirmBase <= deliveryTag))
+      {
+        Unconfirmed entry(std::move(s.unconfirmed.front()));
+        s.unconfirmed.pop_front();
+        ++s.confirmBase;
+        if (!entry.done && entry.callback) entry.callback(ack);
+      }
+    }
+    else
+    {
+      Unconfirmed& entry = s.unconfirmed[deliveryTag - s.confirmBase];
+      entry.done = true;
+      ConfirmCallback callback(nullptr);
+      callback.swap(entry.callback);
+      if (callback) callback(ack);
+      while (!s.unconfirmed.empty() && s.unconfirmed.front().done)
+      {
+        s.unconfirmed.pop_front();
+        ++s.confirmBase;
+      }
+    }
+  if (full && writable() && (m_state == eReady) && m_onDrain) m_onDrain();
+}
+
+void Transceiver::AdaptPrefetch(bool delivered)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (m_windowStart == std::chrono::steady_clock::time_point())
+    m_windowStart = m_heldChanged = now;
+  m_heldArea += m_held *
+                std::chrono::duration<double>(now - m_heldChanged).count();
+  m_heldChanged = now;
+  if (delivered)
+  {
+    ++m_held;
+    return;
+  }
+  if (m_held) --m_held;
+  // every channel of the transceiver holds prefetchCount() messages, each
+  // of them comes round at least once in the window
+  uint32_t inFlight = m_prefetchCount * m_stripes.size();
+  if (++m_windowMessages < std::max(inFlight, MinWindow)) return;
+  double elapsed = std::chrono::duration<double>(now - m_windowStart).count(),
+         throughput = m_windowMessages / elapsed,
+         held = m_heldArea / elapsed; // Little's law: at the consumer
+  m_windowStart = now;
+  m_heldArea = 0;
+  m_windowMessages = 0;
+  // the broker hands out or takes back the difference of a new limit
+  // during the next window, it shows no steady state
+  if (m_windowSkip)
+  {
+    m_windowSkip = false;
+    return;
+  }
+  if ((elapsed <= 0) || (held <= 0)) return;
+  double hold = held / throughput; // delivery to ack
+  uint32_t count = m_prefetchCount;
+  if (m_climbing)
+  {
+    // The throughput followed a larger window: the consumer idled while
+    // acks travelled. Otherwise the previous window was enough, it is kept
+    // with a quarter of headroom.
+    if (!m_lastCount || (throughput > 1.1 * m_lastThroughput))
+    {
+      count *= 2;
+      m_lastCount = m_prefetchCount;
+    }
+      else
+      {
+        count = m_lastCount + (m_lastCount + 3) / 4;
+        m_climbing = false;
+        m_lastCount = 0;
+      }
+    m_lastThroughput = throughput;
+  }
+  else if (!m_lastCount)
+  {
+    // the reference of the settled window
+    m_lastCount = count;
+    m_lastThroughput = throughput;
+    m_lastHold = hold;
+    m_drift = 0;
+  }
+  else if ((std::fabs(throughput / m_lastThroughput - 1) > 0.33) ||
+           (std::fabs(hold / m_lastHold - 1) > 0.33))
+  {
+    // the load or the consumer changed for two windows in a row: climb
+    // again from below
+    if (++m_drift > 1)
+    {
+      count /= 4;
+      m_climbing = true;
+      m_lastCount = 0;
+    }
+  }
+  else m_drift = 0;
+  count = std::min<uint32_t>(std::max<uint32_t>(count, m_prefetchMin),
+                             m_prefetchMax);
+  if (count == m_prefetchCount) return;
+  m_windowSkip = true;
+#ifndef NDEBUG
+std::clog << "Transceiver prefetch " << m_prefetchCount << " -> " << count << std::endl;
+#endif
+  m_prefetchCount = count;
+  for (auto& stripe: m_stripes) stripe.channel->setQos(m_prefetchCount);
+}
+
+void Transceiver::FailUnconfirmed()
+{
+  m_confirmMode = false;
+  for (std::size_t i = 0; i < m_stripes.size(); ++i)
+  {
+    std::deque<Unconfirmed> unconfirmed;
+    unconfirmed.swap(m_stripes[i].unconfirmed);
+    m_stripes[i].confirmBase = 1;
+    for (auto& entry: unconfirmed)
+      if (!entry.done && entry.callback) entry.callback(false);
+  }
+}
+
 void Transceiver::StateMachine()
 {
   switch (m_state)
@@ -282,6 +742,8 @@ std::clog << "Transceiver eRecreateChannel -> " << m_state << std::endl;
       }
       break;
     case eCreateExchange:
+      // the final channel of the transceiver, nothing published on it yet
+      OpenStripes();
       m_channel->declareExchange(m_exchange, AMQP::topic, ExchangeCreationFlags)
         .onSuccess([this]() {
           if (m_state != eCreateExchange) return;
@@ -369,23 +831,57 @@ std::clog << "Transceiver eBindQueue -> " << m_state << std::endl;
         });
       break;
     case eCreateConsumer:
+      m_prefetchCount = m_prefetch;
+      if (m_prefetchMax)
+      {
+        if ((m_prefetchCount < m_prefetchMin) ||
+            (m_prefetchCount > m_prefetchMax))
+          m_prefetchCount = m_prefetchMin;
+        m_windowStart = std::chrono::steady_clock::time_point();
+        m_held = 0;
+        m_heldArea = 0;
+        m_windowMessages = 0;
+        m_lastCount = 0;
+        m_climbing = true;
+        m_windowSkip = false;
+      }
+      // pipelined ahead of the subscription, no extra round trip
+      if (m_prefetchCount)
+        for (auto& stripe: m_stripes) stripe.channel->setQos(m_prefetchCount);
+      // delivery tags of the new channels start from 1
+      ++m_generation;
+      m_coalescing = (m_ackMaxPending != 0);
+      for (auto& stripe: m_stripes)
+      {
+        stripe.deliveries.clear();
+        stripe.ackFloor = 0;
+        stripe.unsentAcks = 0;
+      }
+      m_unsentAcks = 0;
+      // the transceiver is ready once every channel consumes; deliveries
+      // may come before that and are accepted
+      m_stripesPending = m_stripes.size();
+      // consumers of the other channels share the queue, the primary one
+      // is cancelled on stop; their errors close the channel
+      for (std::size_t i = 1; i < m_stripes.size(); ++i)
+        m_stripes[i].channel->consume(m_recvQueue)
+          .onSuccess([this](const std::string& consumer) {
+            UNUSED(consumer)
+            OnConsumer();
+          })
+          .onReceived([this, i](const AMQP::Message &message,
+                                uint64_t deliveryTag, bool redelivered) {
+            Dispatch(i, message, deliveryTag, redelivered);
+          });
       m_channel->consume(m_recvQueue)
         .onSuccess([this](const std::string& consumer) {
           if (m_state != eCreateConsumer) return;
           m_consumerTag = consumer;
-          m_state = eReady;
-#ifndef NDEBUG
-std::clog << "Transceiver eCreateConsumer(" << m_consumerTag << ") -> " << m_state << std::endl;
-#endif
-          StateMachine();
+          OnConsumer();
         })
         .onReceived([this](const AMQP::Message &message, uint64_t deliveryTag,
                            bool redelivered) {
-          // PROCESS INCOMING MESSAGES
-          if (m_state != eReady) return; // ???
-          if (m_onMessage)
-            m_onMessage(m_channel.get(), message, deliveryTag, redelivered);
-            else OnMessage(m_channel.get(), message, deliveryTag, redelivered);
+          Dispatch(0, message, deliveryTag, redelivered);
         })
         .onError([this](const char* message) {
 #ifndef NDEBUG
@@ -413,6 +909,14 @@ std::clog << "Transceiver eCreateConsumer(" << m_consumerTag << ") -> " << m_sta
         });
       break;
     case eReady:
+      if (m_startedCb)
+      {
+        DoneCallback callback(nullptr);
+        callback.swap(m_startedCb);
+        callback();
+        // the callback could stop the transceiver
+        if (m_state != eReady) break;
+      }
       if (!m_listener)
       {
         m_channel->onError([this](const char* message) {
@@ -430,6 +934,10 @@ std::clog << "Transceiver eReady -> " << m_state << std::endl;
       }
       break;
     case eShutdown:
+      // accumulated acks would be lost with the channel
+      flushAcks();
+      // the broker requeues what the consumers of the other channels hold
+      CloseStripes();
       if (m_listener)
         {
           if (m_consumerTag.empty())
@@ -591,7 +1099,7 @@ std::clog << "Transceiver eRemoveQueue -> " << m_state << std::endl;
     case eCloseChannel:
       m_channel->close()
         .onSuccess([this]() {
-          m_state = eEnd;
+          m_state = eCloseStripes;
 #ifndef NDEBUG
 std::clog << "Transceiver eCloseChannel -> " << m_state << std::endl;
 #endif
@@ -603,23 +1111,56 @@ std::clog << "Transceiver eCloseChannel error: " << message << std::endl;
 #endif
           if (m_ec == eNoError) m_ec = eCloseChannelError;
           if (m_error.empty()) m_error = message;
-          m_state = eEnd;
+          m_state = eCloseStripes;
 #ifndef NDEBUG
 std::clog << "Transceiver eCloseChannel -> " << m_state << std::endl;
 #endif
           StateMachine();
         });
       break;
+    case eCloseStripes:
+      // stop() before eReady comes here without eShutdown
+      CloseStripes();
+      // the stripes are reset in eEnd, their closing must be finished
+      if (m_stripesPending) break;
+      m_state = eEnd;
+#ifndef NDEBUG
+std::clog << "Transceiver eCloseStripes -> " << m_state << std::endl;
+#endif
+      StateMachine();
+      break;
     case eEnd:
       m_connection = nullptr;
       m_recvQueue.clear();
       m_consumerTag.clear();
       m_queueExist = false;
       m_channel.reset();
+      FailUnconfirmed();
+      m_coalescing = false;
+      // the vector stays, a confirm callback may still hold a stripe
+      for (auto& stripe: m_stripes)
+      {
+        stripe.channel.reset();
+        stripe.deliveries.clear();
+        stripe.unsentAcks = 0;
+      }
+      m_unsentAcks = 0;
 #ifndef NDEBUG
 std::clog << "Transceiver eEnd" << std::endl;
 #endif
       if (m_onExit) m_onExit(m_ec);
+      if (m_startedCb)
+      {
+        DoneCallback callback(nullptr);
+        callback.swap(m_startedCb);
+        callback();
+      }
+      if (m_stoppedCb)
+      {
+        DoneCallback callback(nullptr);
+        callback.swap(m_stoppedCb);
+        callback();
+      }
       break;
     default:
       break;
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <ostream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <amqpcpp.h>
 #include <rapidjson/document.h>
+#include "AmqpAckHandle.hpp"
+#include "AmqpConnectionStats.hpp"
 
 namespace amqp {
 
@@ -55,6 +61,56 @@ namespace amqp {
 /// делает ничего, в том числе, не подтверждает сообщение. Такое поведение
 /// может быть изменено в классах-потомках.
 ///
+/// Если соединение с брокером перегружено исходящими данными (см.
+/// amqp::ConnectionOptions::highWatermark), приемопередатчик сообщает об
+/// этом методом writable(). Когда очередь исходящих данных освободится,
+/// будет вызвана функция, назначенная методом onDrain(). Если коннектор
+/// создан с параметром amqp::ConnectionOptions::refuseAboveHighWatermark, то
+/// на время перегрузки send() отказывает в публикации, и отправитель должен
+/// дождаться вызова onDrain().
+///
+/// Метод enableConfirms() включает подтверждение публикаций брокером
+/// (publisher confirms). Каждому вызову send() можно передать функцию
+/// ConfirmCallback, которая будет вызвана, когда брокер подтвердит
+/// (basic.ack) или отвергнет (basic.nack) сообщение. Публикации не ждут
+/// подтверждения предыдущих, но число неподтвержденных можно ограничить:
+/// пока окно заполнено, writable() возвращает ложь, а send() отказывает в
+/// публикации; освобождение окна сообщается через onDrain(). Если канал
+/// закрывается раньше, чем пришло подтверждение, функции вызываются с
+/// признаком отказа.
+///
+/// Число входящих сообщений, которые брокер выдает приемнику без
+/// подтверждения, ограничивается методом prefetch() (basic.qos). В
+/// адаптивном режиме (adaptivePrefetch()) ограничение подстраивается по
+/// темпу подтверждений и времени от выдачи сообщения до его подтверждения:
+/// растет, пока вместе с ним растет темп, то есть получатель простаивает в
+/// ожидании сообщений, и подбирается заново, когда меняется нагрузка.
+///
+/// Входящие сообщения можно подтверждать методом ack() приемопередатчика
+/// вместо AMQP::Channel::ack(). После вызова coalesceAcks() подтверждения
+/// накапливаются и отправляются брокеру одним кадром с флагом "multiple" на
+/// каждую непрерывную последовательность номеров: по достижении заданного
+/// числа или возраста, а также когда коннектор завершает текущую порцию
+/// работы (разбор принятых данных или другой обработчик). Сообщения,
+/// обработанные не по порядку, подтверждаются, только когда обработаны все
+/// предыдущие, либо по отдельности при отправке накопленного.
+///
+/// Чтобы подтвердить сообщение из другого потока, обработчик получает
+/// методом ackHandle() экземпляр AckHandle и передает его туда вместе с
+/// работой.
+///
+/// Множество сообщений выгоднее публиковать одним вызовом sendBatch(): он
+/// проверяет готовность один раз, кодирует сообщения подряд в очередь
+/// исходящих данных соединения и отправляет их одной операцией записи.
+///
+/// Один канал AMQP выстраивает в очередь все публикации и подтверждения
+/// приемопередатчика, а в брокере обслуживается одним процессом. Метод
+/// stripeChannels() открывает несколько каналов: публикации распределяются
+/// между ними по кругу или по маршруту (StripeMode), а в каждом канале
+/// регистрируется свой подписчик на ту же очередь. Метки входящих сообщений
+/// нумеруются в каждом канале отдельно, поэтому подтверждения, сделанные
+/// вне обработчика сообщения, должны указывать канал, см. ack().
+///
 /// При завершении работы приемопередатчика вызывается функция, заданная
 /// методом onExit(). Ее сигнатура должна совпадать с сигнатурой ExitCallback.
 /// Если функция для данного приемопередатчика задана не была, то не делается
@@ -97,7 +153,7 @@ namespace amqp {
 /// eBindQueue --> eCreateConsumer : Success
 /// eBindQueue --> eRemoveQueue : Fail
 ///
-/// eCreateConsumer --> eReady : Success
+/// eCreateConsumer --> eReady : Success (consumers of all channels)
 /// eCreateConsumer --> eUnbindQueue : Fail
 ///
 /// eReady --> eShutdown : Transceiver::stop()
@@ -118,8 +174,10 @@ namespace amqp {
 /// eRemoveQueue --> eEnd : Channel restored, but queue not removed
 /// eRemoveQueue --> eEnd : Channel not restored
 ///
-/// eCloseChannel --> eEnd : Success
-/// eCloseChannel --> eEnd : Fail
+/// eCloseChannel --> eCloseStripes : Success
+/// eCloseChannel --> eCloseStripes : Fail
+///
+/// eCloseStripes --> eEnd : Other channels closed (or none)
 ///
 /// eEnd --> [*]
 /// @enduml
@@ -181,6 +239,45 @@ class Transceiver
       const ExitCode& ec
     )> ExitCallback;
 
+    ///
+    /// Указатель на функцию обратного вызова при освобождении очереди
+    /// исходящих данных соединения.
+    ///
+    typedef std::function<void()> DrainCallback;
+
+    ///
+    /// Указатель на функцию обратного вызова при подтверждении публикации
+    /// брокером.
+    ///
+    /// Параметр -- брокер принял сообщение (basic.ack) или нет (basic.nack,
+    /// закрытие канала до подтверждения).
+    ///
+    typedef std::function<void(bool ack)> ConfirmCallback;
+
+    ///
+    /// Распределение публикаций между каналами, см. stripeChannels().
+    ///
+    enum StripeMode
+    {
+      eRoundRobin, ///< По кругу, порядок сообщений между каналами не
+                   ///< сохраняется.
+      eByRoute ///< По маршруту сообщения, сообщения с одним маршрутом
+               ///< публикуются в одном канале по порядку.
+    };
+
+    ///
+    /// Сообщение для пакетной публикации, см. sendBatch().
+    ///
+    struct BatchEntry
+    {
+      std::string route; ///< Маршрут публикуемого сообщения.
+      std::string body; ///< Тело сообщения.
+      AMQP::MetaData properties; ///< Свойства сообщения ("content type" и
+                                 ///< т.д.).
+      ConfirmCallback confirmed; ///< Обратный вызов при подтверждении
+                                 ///< публикации брокером (необязательный).
+    };
+
     ///
     /// Конструктор.
     ///
@@ -249,6 +346,26 @@ class Transceiver
     ///
     inline bool ready() const { return m_state == eReady; }
     ///
+    /// Готовность соединения с брокером принимать исходящие данные.
+    ///
+    /// @return Готово или нет.
+    ///
+    /// В режиме подтверждения публикаций также учитывается заполненность
+    /// окна неподтвержденных сообщений, см. enableConfirms().
+    ///
+    inline bool writable() const { return m_writable && !windowFull(); }
+    ///
+    /// Число публикаций, ожидающих подтверждения брокером.
+    ///
+    /// @return Число сообщений.
+    ///
+    inline std::size_t unconfirmed() const
+    {
+      std::size_t count = 0;
+      for (auto& stripe: m_stripes) count += stripe.unconfirmed.size();
+      return count;
+    }
+    ///
     /// Извлечь код ошибки завершения.
     ///
     /// @return Код ошибки.
@@ -282,6 +399,154 @@ class Transceiver
     /// @param [in] callback Указатель на функцию.
     ///
     void onExit(ExitCallback callback);
+    ///
+    /// Назначить обратный вызов для освобождения очереди исходящих данных.
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    void onDrain(DrainCallback callback);
+    ///
+    /// Включить подтверждение публикаций брокером (publisher confirms).
+    ///
+    /// @param [in] window Наибольшее число сообщений, ожидающих
+    ///                    подтверждения (необязательный). Нуль -- без
+    ///                    ограничения.
+    ///
+    /// Канал переводится в режим подтверждений при запуске приемопередатчика,
+    /// поэтому метод вызывается до start(). Окно общее для всех каналов
+    /// приемопередатчика, см. stripeChannels().
+    ///
+    void enableConfirms(std::size_t window = 0);
+    ///
+    /// Открывать для приемопередатчика несколько каналов.
+    ///
+    /// @param [in] count Число каналов, не меньше 1.
+    /// @param [in] mode Распределение публикаций (необязательный).
+    ///
+    /// Каналы открываются при запуске приемопередатчика, поэтому метод
+    /// вызывается до start(). Каждый канал приемника получает свой
+    /// подписчик и свое ограничение prefetch(); приемопередатчик готов,
+    /// когда подписаны все каналы. Ошибка любого канала завершает
+    /// приемопередатчик. Остановка завершается после закрытия всех каналов.
+    ///
+    void stripeChannels(std::size_t count, StripeMode mode = eRoundRobin);
+    ///
+    /// Число каналов приемопередатчика.
+    ///
+    /// @return Число каналов.
+    ///
+    inline std::size_t channelCount() const { return m_stripeCount; }
+    ///
+    /// Ограничить число входящих сообщений, выданных брокером без
+    /// подтверждения (prefetch).
+    ///
+    /// @param [in] count Наибольшее число сообщений. Нуль -- без
+    ///                   ограничения.
+    ///
+    /// Ограничение задается брокеру (basic.qos) перед регистрацией
+    /// подписчика в каждом канале, поэтому метод вызывается до start().
+    /// Ограничение объема сообщений (prefetch size) AMQP-CPP не
+    /// поддерживает. Отключает адаптивный режим.
+    ///
+    void prefetch(uint16_t count);
+    ///
+    /// Включить адаптивный подбор ограничения prefetch.
+    ///
+    /// @param [in] minCount Нижняя граница ограничения, не меньше 1.
+    /// @param [in] maxCount Верхняя граница ограничения.
+    ///
+    /// Ограничение пересчитывается после подтверждения каждого очередного
+    /// окна сообщений. Замеряются время от выдачи сообщения обработчику до
+    /// его подтверждения и темп подтверждений, поэтому сообщения должны
+    /// подтверждаться или отвергаться через ack(), reject() или AckHandle --
+    /// в обработчике или позже, из другого потока. Начальное ограничение --
+    /// заданное prefetch(), если оно в пределах границ, иначе minCount.
+    ///
+    void adaptivePrefetch(uint16_t minCount, uint16_t maxCount);
+    ///
+    /// Текущее ограничение prefetch.
+    ///
+    /// @return Число сообщений на канал, нуль -- без ограничения.
+    ///
+    inline uint16_t prefetchCount() const { return m_prefetchCount; }
+    ///
+    /// Поколение каналов приемника.
+    ///
+    /// @return Номер, который увеличивается при каждой регистрации
+    ///         подписчиков в новых каналах.
+    ///
+    /// Метки входящих сообщений (deliveryTag) действительны только в канале,
+    /// через который сообщения получены. Подтверждение, отложенное на время
+    /// обработки, нужно отбросить, если поколение канала сменилось.
+    ///
+    inline uint64_t generation() const { return m_generation; }
+    ///
+    /// Включить накопление подтверждений входящих сообщений.
+    ///
+    /// @param [in] maxPending Число накопленных подтверждений, по
+    ///                        достижении которого они отправляются.
+    /// @param [in] maxDelay Наибольший возраст накопленного подтверждения
+    ///                      (необязательный).
+    ///
+    /// Если maxDelay нулевой, накопленное отправляется, как только strand
+    /// коннектора закончит текущий обработчик (например, разбор всех
+    /// принятых сообщений). Иначе первое накопленное подтверждение заводит
+    /// таймер (см. scheduler()), и подтверждения отправляются по достижении
+    /// maxPending или по истечении maxDelay, что наступит раньше.
+    ///
+    /// Действует со следующего запуска приемопередатчика. Пока накопление
+    /// включено, все входящие сообщения должны подтверждаться или
+    /// отвергаться через ack() и reject(), иначе непрерывные
+    /// последовательности номеров не складываются.
+    ///
+    void coalesceAcks(std::size_t maxPending,
+                      std::chrono::microseconds maxDelay =
+                        std::chrono::microseconds(0));
+    ///
+    /// Подтвердить входящее сообщение.
+    ///
+    /// @param [in] deliveryTag Метка сообщения.
+    /// @param [in] channel Канал, через который получено сообщение
+    ///                     (необязательный).
+    /// @return false, если канал приемопередатчика закрыт, а при накоплении
+    ///         также если сообщение с такой меткой через канал не
+    ///         получено. Для уже подтвержденного или отвергнутого сообщения
+    ///         возвращается true.
+    ///
+    /// Без накопления подтверждение отправляется сразу.
+    ///
+    /// Если канал не указан, берется канал сообщения, обработчик которого
+    /// выполняется, а вне обработчика -- основной канал приемопередатчика.
+    ///
+    bool ack(uint64_t deliveryTag, AMQP::Channel* channel = nullptr);
+    ///
+    /// Отвергнуть входящее сообщение.
+    ///
+    /// @param [in] deliveryTag Метка сообщения.
+    /// @param [in] requeue Вернуть сообщение в очередь (необязательный).
+    /// @param [in] channel Канал, через который получено сообщение
+    ///                     (необязательный), см. ack().
+    /// @return false, если канал приемопередатчика закрыт.
+    ///
+    /// Отказ отправляется сразу, минуя накопление.
+    ///
+    bool reject(uint64_t deliveryTag, bool requeue = true,
+                AMQP::Channel* channel = nullptr);
+    ///
+    /// Отправить накопленные подтверждения.
+    ///
+    void flushAcks();
+    ///
+    /// Выдать отложенное подтверждение входящего сообщения.
+    ///
+    /// @param [in] deliveryTag Метка сообщения.
+    /// @param [in] channel Канал, через который получено сообщение
+    ///                     (необязательный), см. ack().
+    /// @return Экземпляр AckHandle, который можно передать в другой поток.
+    ///
+    /// Вызывается в обработчике входящего сообщения (в strand коннектора).
+    ///
+    AckHandle ackHandle(uint64_t deliveryTag, AMQP::Channel* channel = nullptr);
 
     ///
     /// Опубликовать сообщение в формате JSON.
@@ -290,10 +555,13 @@ class Transceiver
     /// @param [in] route Маршрут публикуемого сообщения.
     /// @param [in] mandatory Делать обратный вызов, если для сообщения нет
     ///                       получателей (необязательный).
+    /// @param [in] confirmed Обратный вызов при подтверждении публикации
+    ///                       брокером (необязательный).
     /// @return Успешно или нет отправлено сообщение.
     ///
     /// Успех здесь означает, что приемопередатчик инициировал передачу
-    /// сообщения брокеру средствами AMQP-CPP.
+    /// сообщения брокеру средствами AMQP-CPP. В публикации может быть
+    /// отказано, если соединение перегружено, см. writable().
     ///
     /// Сообщение публикуется с заголовками "content type", равным
     /// "application/json", и "content encoding", равным "utf-8".
@@ -301,8 +569,11 @@ class Transceiver
     /// По умолчанию mandatory равен истине, т.е. если функция обратного
     /// вызова определена, то она будет запущена.
     ///
+    /// confirmed вызывается, только если включено подтверждение публикаций,
+    /// см. enableConfirms().
+    ///
     bool send(const rapidjson::Document& message, const std::string& route,
-              bool mandatory = true);
+              bool mandatory = true, ConfirmCallback confirmed = nullptr);
     ///
     /// Опубликовать текстовое сообщение.
     ///
@@ -310,10 +581,13 @@ class Transceiver
     /// @param [in] route Маршрут публикуемого сообщения.
     /// @param [in] mandatory Делать обратный вызов, если для сообщения нет
     ///                       получателей (необязательный).
+    /// @param [in] confirmed Обратный вызов при подтверждении публикации
+    ///                       брокером (необязательный).
     /// @return Успешно или нет отправлено сообщение.
     ///
     /// Успех здесь означает, что приемопередатчик инициировал передачу
-    /// сообщения брокеру средствами AMQP-CPP.
+    /// сообщения брокеру средствами AMQP-CPP. В публикации может быть
+    /// отказано, если соединение перегружено, см. writable().
     ///
     /// Сообщение публикуется с заголовками "content type", равным
     /// "text/plain", и "content encoding", равным "utf-8".
@@ -321,8 +595,47 @@ class Transceiver
     /// По умолчанию mandatory равен истине, т.е. если функция обратного
     /// вызова определена, то она будет запущена.
     ///
+    /// confirmed вызывается, только если включено подтверждение публикаций,
+    /// см. enableConfirms().
+    ///
     bool send(const std::string& message, const std::string& route,
-              bool mandatory = true);
+              bool mandatory = true, ConfirmCallback confirmed = nullptr);
+    ///
+    /// Опубликовать пакет сообщений.
+    ///
+    /// @param [in] first Начало последовательности BatchEntry.
+    /// @param [in] last Конец последовательности.
+    /// @param [in] mandatory Делать обратный вызов, если для сообщения нет
+    ///                       получателей (необязательный).
+    /// @return Число опубликованных сообщений, от начала последовательности.
+    ///
+    /// Готовность приемопередатчика проверяется один раз на весь пакет.
+    /// Сообщения кодируются подряд, пока отправка исходящих данных
+    /// соединения приостановлена, и уходят брокеру одной операцией записи.
+    /// Свойства сообщений берутся из BatchEntry::properties как есть.
+    ///
+    /// В режиме подтверждения публикаций пакет обрывается, когда
+    /// заполняется окно неподтвержденных сообщений, см. enableConfirms().
+    ///
+    template<class Iterator>
+    std::size_t sendBatch(Iterator first, Iterator last, bool mandatory = true)
+    {
+      if (m_state != eReady) return 0;
+      if (!m_writable && m_refuseUnwritable) return 0;
+      int flags = mandatory ? int(AMQP::mandatory) : 0;
+      std::size_t sent = 0;
+      if (m_cork) m_cork(true);
+      for (; (first != last) && !windowFull(); ++first, ++sent)
+      {
+        const BatchEntry& entry = *first;
+        AMQP::Envelope envelope(entry.properties, entry.body.data(),
+                                entry.body.size());
+        publish(envelope, entry.route, flags, entry.confirmed);
+      }
+      if (m_counters) ConnectionCounters::Add(m_counters->published, sent);
+      if (m_cork) m_cork(false);
+      return sent;
+    }
 
   protected:
     ///
@@ -364,11 +677,14 @@ class Transceiver
       // автоматически при закрытии канала, поэтому отдельного шага для его
       // удаления не делаем.
       eCloseChannel, ///< Закрывается канал AMQP.
+      eCloseStripes, ///< Ожидается закрытие дополнительных каналов.
       eEnd, ///< Автомат завершился, это же начальное состояние.
       eMax
     };
     static const int ExchangeCreationFlags; ///< Флаги, с которыми создается
                                             ///< (открывается) точка обмена.
+    static const uint32_t MinWindow; ///< Наименьшее число подтверждений в
+                                     ///< окне замера адаптивного prefetch.
     static std::unordered_map<State, State> StopTransit; ///< Таблица переходов
                                                          ///< для остановки
                                                          ///< клиента в stop().
@@ -395,6 +711,7 @@ class Transceiver
         "eUnbindQueue",
         "eRemoveQueue",
         "eCloseChannel",
+        "eCloseStripes",
         "eEnd",
         "eMax"
       };
@@ -402,10 +719,73 @@ class Transceiver
       return out;
     }
 
+    ///
+    /// Указатель на функцию обратного вызова при завершении запуска или
+    /// остановки.
+    ///
+    typedef std::function<void()> DoneCallback;
+
+    ///
+    /// Указатель на функцию приостановки (cork = true) и возобновления
+    /// отправки исходящих данных соединения.
+    ///
+    typedef std::function<void(bool cork)> CorkCallback;
+
+    ///
+    /// Указатель на функцию, выполняющую задачу в strand коннектора по
+    /// истечении задержки, если приемопередатчик еще существует.
+    ///
+    typedef std::function<void(
+      std::chrono::microseconds delay,
+      std::function<void(Transceiver& transceiver)> task
+    )> ScheduleCallback;
+
+    ///
+    /// Состояние входящего сообщения при накоплении подтверждений.
+    ///
+    enum Delivery : uint8_t
+    {
+      ePending, ///< Не обработано.
+      eCompleted, ///< Обработано, подтверждение накоплено.
+      eSettled ///< Подтверждение или отказ отправлены брокеру.
+    };
+
+    ///
+    /// Публикация, ожидающая подтверждения брокером.
+    ///
+    struct Unconfirmed
+    {
+      ConfirmCallback callback; ///< Обратный вызов отправителя.
+      bool done; ///< Подтверждение уже получено.
+    };
+
+    ///
+    /// Канал приемопередатчика с состоянием публикаций и входящих сообщений.
+    ///
+    /// Нулевой -- основной канал m_channel, который ведет конечный автомат.
+    ///
+    struct Stripe
+    {
+      std::shared_ptr<AMQP::Channel> channel; ///< Канал.
+      std::deque<Unconfirmed> unconfirmed; ///< Публикации, ожидающие
+                                           ///< подтверждения, по порядку
+                                           ///< номеров.
+      uint64_t confirmBase = 1; ///< Номер первой публикации в unconfirmed.
+      bool returnsWatched = false; ///< Каналу назначен обработчик
+                                   ///< возвращенных сообщений.
+      std::deque<Delivery> deliveries; ///< Состояния входящих сообщений,
+                                       ///< начиная с номера ackFloor + 1.
+      uint64_t ackFloor = 0; ///< Все сообщения до этого номера включительно
+                             ///< подтверждены или отвергнуты.
+      std::size_t unsentAcks = 0; ///< Число накопленных подтверждений.
+    };
+
     ///
     /// Запустить приемопередатчик.
     ///
     /// @param [in] connection Указатель на класс соединения с брокером AMQP.
+    /// @param [in] callback Обратный вызов при завершении запуска
+    ///                      (необязательный).
     ///
     /// Запуск производится асинхронно. Ход и результаты запуска проверяются
     /// методами is_running() и ready(). Пока процедура продолжается,
@@ -415,19 +795,29 @@ class Transceiver
     /// обратного вызова, если она была задана.
     ///
     /// Запуск возможен, если приемопередатчик не был запущен ранее. В
-    /// противном случае метод не делает ничего.
+    /// противном случае метод не делает ничего, кроме обратного вызова: он
+    /// выполняется сразу, если приемопередатчик уже готов, или по завершении
+    /// идущего запуска.
+    ///
+    /// Обратный вызов выполняется в любом случае, удачном или нет. Результат
+    /// запуска проверяется методом ready().
     ///
-    void start(AMQP::Connection* connection);
+    void start(AMQP::Connection* connection, DoneCallback callback = nullptr);
     ///
     /// Остановить приемопередатчик.
     ///
+    /// @param [in] callback Обратный вызов при завершении остановки
+    ///                      (необязательный).
+    ///
     /// Остановка также производится асинхронно. Признак завершения работы --
     /// метод is_running() возвращает ложь. По завершению запускается
-    /// соответствующая функция обратного вызова, если она была задана.
+    /// соответствующая функция обратного вызова, если она была задана, и
+    /// callback.
     ///
-    /// Если автомат не запущен, метод не делает ничего.
+    /// Если автомат не запущен, метод не делает ничего, кроме немедленного
+    /// вызова callback.
     ///
-    void stop();
+    void stop(DoneCallback callback = nullptr);
     ///
     /// Сбросить приемопередатчик.
     ///
@@ -438,6 +828,174 @@ class Transceiver
     ///
     void drop();
     ///
+    /// Задать реакцию на перегрузку соединения.
+    ///
+    /// @param [in] refuse Отказывать в публикации, пока соединение
+    ///                    перегружено.
+    ///
+    inline void backpressure(bool refuse) { m_refuseUnwritable = refuse; }
+    ///
+    /// Задать счетчики статистики коннектора.
+    ///
+    /// @param [in] counters Указатель на счетчики.
+    ///
+    inline void counters(ConnectionCounters* counters) { m_counters = counters; }
+    ///
+    /// Задать приостановку отправки исходящих данных на время sendBatch().
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    inline void corking(CorkCallback callback) { m_cork = callback; }
+    ///
+    /// Задать передачу задач в strand коннектора.
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    /// Через нее откладывается отправка накопленных подтверждений и
+    /// разбирается очередь AckHandle. Без нее накопленные подтверждения
+    /// отправляются сразу, а AckHandle не работают.
+    ///
+    inline void poster(AckQueue::PostCallback callback) { m_post = callback; }
+    ///
+    /// Задать выполнение задач в strand коннектора по таймеру.
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    /// Через нее ограничивается возраст накопленных подтверждений, см.
+    /// coalesceAcks(). Без нее maxDelay не действует.
+    ///
+    inline void scheduler(ScheduleCallback callback) { m_schedule = callback; }
+    ///
+    /// Сменить готовность соединения принимать исходящие данные.
+    ///
+    /// @param [in] writable Готово соединение или нет.
+    ///
+    /// При восстановлении готовности вызывается m_onDrain.
+    ///
+    void setWritable(bool writable);
+    ///
+    /// Окно неподтвержденных публикаций заполнено.
+    ///
+    /// @return Заполнено или нет.
+    ///
+    inline bool windowFull() const
+    {
+      return m_confirmWindow && (unconfirmed() >= m_confirmWindow);
+    }
+    ///
+    /// Опубликовать сообщение в канале.
+    ///
+    /// @param [in] envelope Сообщение.
+    /// @param [in] route Маршрут публикуемого сообщения.
+    /// @param [in] flags Флаги публикации.
+    /// @param [in] confirmed Обратный вызов при подтверждении публикации.
+    ///
+    /// Счетчик опубликованных сообщений не изменяется.
+    ///
+    void publish(const AMQP::Envelope& envelope, const std::string& route,
+                 int flags, ConfirmCallback confirmed);
+    ///
+    /// Выбрать канал для публикации.
+    ///
+    /// @param [in] route Маршрут публикуемого сообщения.
+    /// @return Канал.
+    ///
+    Stripe& PickStripe(const std::string& route);
+    ///
+    /// Найти канал по указателю AMQP-CPP.
+    ///
+    /// @param [in] channel Канал, nullptr -- см. ack().
+    /// @return Канал или nullptr, если у приемопередатчика такого нет.
+    ///
+    Stripe* FindStripe(AMQP::Channel* channel);
+    ///
+    /// Открыть дополнительные каналы и перевести все каналы в режим
+    /// подтверждения публикаций, если он включен.
+    ///
+    /// Вызывается, когда основной канал окончательно открыт.
+    ///
+    void OpenStripes();
+    ///
+    /// Закрыть дополнительные каналы.
+    ///
+    /// Закрытие отправляется один раз за сеанс; состояние eCloseStripes
+    /// завершается, когда брокер ответит на все закрытия.
+    ///
+    void CloseStripes();
+    ///
+    /// Учесть подтверждение подписки одного из каналов.
+    ///
+    /// Автомат переходит в eReady, когда подписаны все каналы.
+    ///
+    void OnConsumer();
+    ///
+    /// Идет ли прием: подписка заказана или действует.
+    ///
+    /// Сообщения приходят, как только подписан хотя бы один канал, поэтому
+    /// они принимаются и подтверждаются уже в eCreateConsumer.
+    ///
+    inline bool Consuming() const
+    {
+      return (m_state == eCreateConsumer) || (m_state == eReady);
+    }
+    ///
+    /// Передать входящее сообщение обработчику.
+    ///
+    /// @param [in] stripe Номер канала, через который получено сообщение.
+    /// @param [in] message Входящее сообщение.
+    /// @param [in] deliveryTag Метка сообщения.
+    /// @param [in] redelivered Сообщение доставляется повторно.
+    ///
+    void Dispatch(std::size_t stripe, const AMQP::Message& message,
+                  uint64_t deliveryTag, bool redelivered);
+    ///
+    /// Назначить каналу обработчик возвращенных брокером сообщений.
+    ///
+    /// @param [in] publisher Объект AMQP-CPP, возвращенный публикацией.
+    ///
+    /// AMQP-CPP держит один такой объект на канал, поэтому обработчик
+    /// назначается при первой публикации в канале и дальше обслуживает все
+    /// сообщения, передавая их m_onBounceMessage.
+    ///
+    void watchReturns(AMQP::DeferredPublisher& publisher);
+    ///
+    /// Обработать подтверждение (basic.ack) или отказ (basic.nack) брокера.
+    ///
+    /// @param [in] stripe Номер канала.
+    /// @param [in] deliveryTag Номер публикации в канале.
+    /// @param [in] multiple Подтверждаются все публикации до deliveryTag
+    ///                      включительно.
+    /// @param [in] ack Подтверждение или отказ.
+    ///
+    /// Подтвержденные подряд с начала окна публикации удаляются из него,
+    /// поэтому каждая обходится один раз, сколько бы их ни покрывал флаг
+    /// multiple.
+    ///
+    void OnConfirm(std::size_t stripe, uint64_t deliveryTag, bool multiple,
+                   bool ack);
+    ///
+    /// Отказать всем публикациям, ожидающим подтверждения.
+    ///
+    /// Вызывается при закрытии каналов.
+    ///
+    void FailUnconfirmed();
+    ///
+    /// Учесть выдачу или подтверждение входящего сообщения в адаптивном
+    /// режиме prefetch.
+    ///
+    /// @param [in] delivered Сообщение выдано обработчику, иначе --
+    ///                       подтверждено или отвергнуто.
+    ///
+    /// По окончании окна из prefetchCount() подтверждений на канал (но не
+    /// меньше MinWindow) замеряет темп подтверждений и среднее время до
+    /// подтверждения (по формуле Литтла: среднее число сообщений у
+    /// получателя на темп). Ограничение удваивается, пока темп растет вслед
+    /// за ним, затем закрепляется на последнем полезном значении с запасом в
+    /// четверть. Если темп или время заметно меняются два окна подряд,
+    /// подбор начинается заново с четверти ограничения.
+    ///
+    void AdaptPrefetch(bool delivered);
+    ///
     /// Конечный автомат приемопередатчика.
     ///
     void StateMachine();
@@ -459,7 +1017,68 @@ class Transceiver
                                  ///< при появлении входящего сообщения.
     ExitCallback m_onExit; ///< Указатель на функцию, вызываемую при завершении
                            ///< основного цикла приемопередатчика.
-    std::shared_ptr<AMQP::Channel> m_channel; ///< Канал связи с брокером AMQP.
+    DrainCallback m_onDrain; ///< Указатель на функцию, вызываемую при
+                             ///< освобождении очереди исходящих данных.
+    DoneCallback m_startedCb, ///< Обратный вызов при завершении запуска.
+                 m_stoppedCb; ///< Обратный вызов при завершении остановки.
+    bool m_writable, ///< Соединение готово принимать исходящие данные.
+         m_refuseUnwritable; ///< Отказывать в публикации при перегрузке.
+    bool m_confirms; ///< Включено подтверждение публикаций.
+    std::size_t m_confirmWindow; ///< Наибольшее число неподтвержденных
+                                 ///< публикаций, нуль -- без ограничения.
+    bool m_confirmMode; ///< Каналы переведены в режим подтверждений.
+    std::size_t m_stripeCount; ///< Заданное число каналов.
+    StripeMode m_stripeMode; ///< Распределение публикаций между каналами.
+    std::vector<Stripe> m_stripes; ///< Каналы приемопередатчика, нулевой --
+                                   ///< основной.
+    std::size_t m_nextStripe; ///< Следующий канал публикации по кругу.
+    std::size_t m_dispatch; ///< Канал сообщения, обработчик которого
+                            ///< выполняется.
+    std::size_t m_stripesPending; ///< Число каналов, от которых ожидается
+                                  ///< подтверждение подписки или закрытия.
+    bool m_stripesClosing; ///< Дополнительным каналам отправлено закрытие.
+    uint16_t m_prefetch, ///< Заданное ограничение prefetch.
+             m_prefetchMin, ///< Нижняя граница адаптивного prefetch.
+             m_prefetchMax, ///< Верхняя граница адаптивного prefetch, нуль --
+                            ///< адаптивный режим выключен.
+             m_prefetchCount; ///< Действующее ограничение prefetch.
+    std::chrono::steady_clock::time_point m_windowStart; ///< Начало окна
+                                                         ///< замера.
+    std::chrono::steady_clock::time_point m_heldChanged; ///< Время
+                                                         ///< последнего
+                                                         ///< изменения
+                                                         ///< m_held.
+    uint32_t m_held; ///< Сообщений выдано и не подтверждено.
+    double m_heldArea; ///< Интеграл m_held по времени в окне, с.
+    uint32_t m_windowMessages; ///< Подтверждений в окне замера.
+    double m_lastThroughput, ///< Темп подтверждений в опорном окне, 1/с.
+           m_lastHold; ///< Среднее время до подтверждения в опорном окне,
+                       ///< с.
+    uint16_t m_lastCount; ///< Ограничение prefetch в опорном окне, нуль --
+                          ///< окна нет.
+    bool m_climbing; ///< Ограничение удваивается, пока растет темп.
+    uint32_t m_drift; ///< Окон подряд, темп или время которых заметно
+                      ///< отличаются от опорного.
+    bool m_windowSkip; ///< Окно после смены ограничения не замеряется.
+    uint64_t m_generation; ///< Поколение каналов приемника.
+    std::size_t m_ackMaxPending; ///< Порог числа накопленных подтверждений,
+                                 ///< нуль -- накопление выключено.
+    std::chrono::microseconds m_ackMaxDelay; ///< Порог возраста накопленных
+                                             ///< подтверждений.
+    bool m_coalescing; ///< Накопление подтверждений действует.
+    std::size_t m_unsentAcks; ///< Число накопленных подтверждений во всех
+                              ///< каналах.
+    uint64_t m_ackTimer; ///< Номер таймера накопленных подтверждений,
+                         ///< сработать может только последний.
+    bool m_flushRequested; ///< Отправка накопленного уже отложена.
+    AckQueue::PostCallback m_post; ///< Передача задач в strand коннектора.
+    ScheduleCallback m_schedule; ///< Задачи в strand коннектора по таймеру.
+    std::shared_ptr<AckQueue> m_ackQueue; ///< Очередь подтверждений от
+                                          ///< AckHandle.
+    std::shared_ptr<AMQP::Channel> m_channel; ///< Основной канал связи с
+                                              ///< брокером AMQP.
+    ConnectionCounters* m_counters; ///< Счетчики статистики коннектора.
+    CorkCallback m_cork; ///< Приостановка отправки исходящих данных.
     std::string m_error; ///< Текст последней ошибки.
     ExitCode m_ec; ///< Код ошибки, с которым завершился автомат.
 };
@@ -0,0 +1,106 @@
+#include <cctype>
+#include <cstdlib>
+#include <utility>
+#ifndef NDEBUG
+#include <iostream>
+#endif
+#include "AmqpTransport.hpp"
+
+using namespace amqp;
+
+namespace {
+
+const std::string UnixScheme("amqp+unix://");
+
+///
+/// Найти часть URL с хостом.
+///
+/// @param [in] url URL брокера со схемой amqp+unix.
+/// @param [out] begin Начало хоста в URL.
+/// @param [out] end Конец хоста в URL.
+///
+void HostPart(const std::string& url, std::size_t& begin, std::size_t& end)
+{
+  end = url.find('/', UnixScheme.size());
+  if (end == std::string::npos) end = url.size();
+  begin = url.rfind('@', end);
+  if ((begin == std::string::npos) || (begin < UnixScheme.size()))
+    begin = UnixScheme.size();
+    else ++begin;
+}
+
+} // namespace
+
+Transport::Transport(const boost::asio::io_service::strand& strand):
+  m_strand(strand),
+  m_readCb(nullptr),
+  m_writeCb(nullptr)
+{
+}
+
+Transport::~Transport()
+{
+}
+
+void Transport::releaseCallbacks()
+{
+  auto callbacks = std::make_shared<std::pair<IoCallback, IoCallback>>();
+  callbacks->first.swap(m_readCb);
+  callbacks->second.swap(m_writeCb);
+  // the last reference may be the running callback's owner
+  m_strand.post([callbacks]() {});
+}
+
+void Transport::registerBuffer(const boost::asio::mutable_buffer& region)
+{
+#ifdef AMQPASIO_WITH_IO_URING
+  // io_uring keeps one registered buffer set per ring, the old one goes first
+  m_registration.reset();
+  try
+  {
+    m_registration.reset(new Registration{
+      boost::asio::register_buffers(m_strand.context(), region),
+      boost::asio::buffer_cast<char*>(region),
+      boost::asio::buffer_size(region)
+    });
+  }
+  catch (const boost::system::system_error& e)
+  {
+    // the ring is busy with another connection's buffers
+#ifndef NDEBUG
+std::clog << "Transport::registerBuffer() " << e.what() << std::endl;
+#endif
+  }
+#else
+  (void)region;
+#endif
+}
+
+std::string amqp::UnixSocketPath(const std::string& url)
+{
+  if (url.compare(0, UnixScheme.size(), UnixScheme) != 0) return std::string();
+  std::size_t begin, end;
+  HostPart(url, begin, end);
+  std::string path;
+  for (std::size_t i = begin; i < end; ++i)
+  {
+    if ((url[i] == '%') && (i + 2 < end) &&
+        std::isxdigit(url[i + 1]) && std::isxdigit(url[i + 2]))
+    {
+      path.push_back(char(std::strtol(url.substr(i + 1, 2).c_str(), nullptr, 16)));
+      i += 2;
+      continue;
+    }
+    path.push_back(url[i]);
+  }
+  return path;
+}
+
+std::string amqp::AmqpUrl(const std::string& url)
+{
+  if (url.compare(0, UnixScheme.size(), UnixScheme) != 0) return url;
+  std::size_t begin, end;
+  HostPart(url, begin, end);
+  return "amqp://" + url.substr(UnixScheme.size(), begin - UnixScheme.size()) +
+         "localhost" + url.substr(end);
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/system/error_code.hpp>
+#ifdef AMQPASIO_WITH_IO_URING
+#include <boost/asio/buffer_registration.hpp>
+#include <boost/asio/registered_buffer.hpp>
+#endif
+
+namespace amqp {
+
+///
+/// Транспорт соединения с брокером AMQP.
+
+/// Абстрагирует для amqp::ConnectionHandler поток байтов, по которому идет
+/// обмен с брокером: TCP (в том числе с TLS), сокет домена Unix или обмен в
+/// памяти без сокета. Реализации: TcpTransport, UnixTransport,
+/// LoopbackTransport.
+///
+/// Обработчики завершения приема и передачи назначаются один раз методами
+/// onRead() и onWrite(), сами операции их не принимают. Поэтому на каждую
+/// операцию не создается std::function. Обработчики вызываются через strand,
+/// заданный в конструкторе. Экземпляры создаются только через
+/// std::shared_ptr: каждая незавершенная операция удерживает экземпляр.
+///
+/// Одновременно может выполняться не более одной операции приема и одной
+/// операции передачи. Методы вызываются в контексте strand транспорта.
+///
+/// В сборке с AMQPASIO_WITH_IO_URING (boost::asio поверх io_uring) блок
+/// памяти приема можно зарегистрировать в io_uring методом
+/// registerBuffer(). Прием в зарегистрированную память выполняется
+/// операцией IORING_OP_READ_FIXED, без отображения страниц на каждый
+/// вызов. Так работают TcpTransport без TLS и UnixTransport.
+///
+/// @author cycleg
+///
+class Transport: public std::enable_shared_from_this<Transport>
+{
+  public:
+    typedef std::function<void(const std::string& error)>
+      ConnectCallback; ///< Указатель на функцию, вызываемую по завершении
+                       ///< подключения. Пустая строка -- подключение
+                       ///< установлено, иначе -- описание ошибки.
+
+    typedef std::function<void(const boost::system::error_code& ec,
+                               std::size_t bytes)>
+      IoCallback; ///< Указатель на функцию, вызываемую по завершении приема
+                  ///< или передачи.
+
+    ///
+    /// Последовательность буферов для групповой записи.
+    ///
+    /// Ссылается на вектор буферов, чтобы boost::asio не копировал его при
+    /// каждой записи.
+    ///
+    struct GatherBuffers
+    {
+      typedef boost::asio::const_buffer value_type;
+      typedef std::vector<boost::asio::const_buffer>::const_iterator
+        const_iterator;
+
+      inline const_iterator begin() const { return buffers->begin(); }
+      inline const_iterator end() const { return buffers->end(); }
+
+      const std::vector<boost::asio::const_buffer>* buffers; ///< Буферы.
+    };
+
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] strand Strand, через который вызываются обработчики.
+    ///
+    Transport(const boost::asio::io_service::strand& strand);
+    ///
+    /// Деструктор.
+    ///
+    virtual ~Transport();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    Transport(const Transport&) = delete;
+
+    ///
+    /// Назначить обработчик завершения приема.
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    inline void onRead(IoCallback callback) { m_readCb = callback; }
+    ///
+    /// Назначить обработчик завершения передачи.
+    ///
+    /// @param [in] callback Указатель на функцию.
+    ///
+    inline void onWrite(IoCallback callback) { m_writeCb = callback; }
+    ///
+    /// Снять обработчики завершения приема и передачи.
+    ///
+    /// Обработчики могут выполняться в момент вызова, поэтому уничтожаются
+    /// позже, в strand.
+    ///
+    void releaseCallbacks();
+
+    ///
+    /// Подключиться к брокеру асинхронно.
+    ///
+    /// @param [in] callback Обработчик завершения подключения.
+    ///
+    /// Если подключение прервано вызовом close(), обработчик все равно
+    /// вызывается.
+    ///
+    virtual void connect(ConnectCallback callback) = 0;
+    ///
+    /// Начать асинхронный прием.
+    ///
+    /// @param [in] buffer Буфер для принятых данных.
+    ///
+    /// По завершении вызывается обработчик, назначенный onRead().
+    ///
+    virtual void read(const boost::asio::mutable_buffers_1& buffer) = 0;
+    ///
+    /// Начать асинхронную групповую передачу.
+    ///
+    /// @param [in] buffers Передаваемые буферы. Вектор и данные должны
+    ///                     существовать до завершения передачи.
+    ///
+    /// Передаются все буферы. По завершении вызывается обработчик,
+    /// назначенный onWrite().
+    ///
+    virtual void write(const std::vector<boost::asio::const_buffer>& buffers) = 0;
+    ///
+    /// Закрыть соединение.
+    ///
+    /// Незавершенные операции прерываются, их обработчики вызываются с
+    /// ошибкой boost::asio::error::operation_aborted.
+    ///
+    virtual void close() = 0;
+    ///
+    /// Зарегистрировать блок памяти приема.
+    ///
+    /// @param [in] region Блок памяти, в который будут указывать буферы
+    ///                    операций read().
+    ///
+    /// Прежняя регистрация снимается. Если сборка не использует io_uring
+    /// или регистрация невозможна (в кольце io_uring уже зарегистрированы
+    /// буферы другого соединения), прием идет обычным образом.
+    ///
+    void registerBuffer(const boost::asio::mutable_buffer& region);
+
+  protected:
+    ///
+    /// Запустить прием в зарегистрированную память, если буфер попадает в
+    /// нее.
+    ///
+    /// @param [in] stream Поток (сокет), из которого идет прием.
+    /// @param [in] buffer Буфер приема.
+    /// @param [in] handler Обработчик завершения.
+    /// @return true, если прием запущен.
+    ///
+    template<class Stream, class Handler>
+    bool readRegistered(Stream& stream,
+                        const boost::asio::mutable_buffers_1& buffer,
+                        Handler& handler);
+
+    struct Registration;
+
+    boost::asio::io_service::strand m_strand; ///< Strand обработчиков.
+    IoCallback m_readCb, ///< Обработчик завершения приема.
+               m_writeCb; ///< Обработчик завершения передачи.
+    std::unique_ptr<Registration> m_registration; ///< Регистрация блока
+                                                  ///< памяти приема в
+                                                  ///< io_uring.
+};
+
+#ifdef AMQPASIO_WITH_IO_URING
+
+///
+/// Регистрация блока памяти в io_uring.
+///
+struct Transport::Registration
+{
+  boost::asio::buffer_registration<boost::asio::mutable_buffer>
+    registration; ///< Регистрация boost::asio.
+  char* base; ///< Начало блока.
+  std::size_t size; ///< Размер блока.
+};
+
+template<class Stream, class Handler>
+bool Transport::readRegistered(Stream& stream,
+                               const boost::asio::mutable_buffers_1& buffer,
+                               Handler& handler)
+{
+  if (!m_registration) return false;
+  char* data = boost::asio::buffer_cast<char*>(buffer);
+  std::size_t size = boost::asio::buffer_size(buffer);
+  if ((data < m_registration->base) ||
+      (data + size > m_registration->base + m_registration->size))
+    return false;
+  stream.async_read_some(
+    boost::asio::buffer(*m_registration->registration.begin() +
+                        (data - m_registration->base), size),
+    handler
+  );
+  return true;
+}
+
+#else
+
+///
+/// Регистрация блока памяти (без io_uring не используется).
+///
+struct Transport::Registration
+{
+};
+
+template<class Stream, class Handler>
+bool Transport::readRegistered(Stream&, const boost::asio::mutable_buffers_1&,
+                               Handler&)
+{
+  return false;
+}
+
+#endif
+
+///
+/// Фабрика транспортов.
+///
+/// @param [in] strand Strand соединения.
+/// @return Указатель на новый транспорт.
+///
+typedef std::function<
+  std::shared_ptr<Transport>(const boost::asio::io_service::strand& strand)
+> TransportFactory;
+
+///
+/// Извлечь путь к сокету домена Unix из URL брокера.
+///
+/// @param [in] url URL брокера.
+/// @return Путь к сокету или пустая строка, если схема URL не amqp+unix.
+///
+/// URL вида amqp+unix://user:password@%2Fpath%2Fto%2Fsocket/vhost задает
+/// путь к сокету вместо хоста, символы "/" в пути кодируются как %2F.
+///
+std::string UnixSocketPath(const std::string& url);
+///
+/// Привести URL брокера к виду, понятному AMQP::Address.
+///
+/// @param [in] url URL брокера.
+/// @return URL со схемой amqp:// и хостом localhost для amqp+unix://,
+///         иначе -- исходный URL.
+///
+std::string AmqpUrl(const std::string& url);
+
+} // namespace amqp
@@ -0,0 +1,73 @@
+#ifndef NDEBUG
+#include <iostream>
+#endif
+#include <boost/asio/write.hpp>
+#include "AmqpUnixTransport.hpp"
+
+using namespace amqp;
+
+UnixTransport::UnixTransport(boost::asio::io_service& service,
+                             const boost::asio::io_service::strand& strand,
+                             const std::string& path):
+  Transport(strand),
+  m_socket(service),
+  m_path(path)
+{
+}
+
+UnixTransport::~UnixTransport()
+{
+  // asynchronous operations hold the instance, so none of them is pending
+  boost::system::error_code ec;
+  m_socket.close(ec);
+}
+
+void UnixTransport::connect(ConnectCallback callback)
+{
+#ifndef NDEBUG
+std::clog << "UnixTransport::connect() " << m_path << std::endl;
+#endif
+  auto self(shared_from_this());
+  m_socket.async_connect(
+    boost::asio::local::stream_protocol::endpoint(m_path),
+    m_strand.wrap([this, self, callback](const boost::system::error_code& ec) {
+      if (ec)
+      {
+        callback("failed to connect: " + ec.message());
+        return;
+      }
+      callback(std::string());
+    })
+  );
+}
+
+void UnixTransport::read(const boost::asio::mutable_buffers_1& buffer)
+{
+  auto self(shared_from_this());
+  auto handler = m_strand.wrap(
+    [this, self](const boost::system::error_code& ec, std::size_t bytes) {
+      m_readCb(ec, bytes);
+    }
+  );
+  if (!readRegistered(m_socket, buffer, handler))
+    m_socket.async_read_some(buffer, handler);
+}
+
+void UnixTransport::write(const std::vector<boost::asio::const_buffer>& buffers)
+{
+  auto self(shared_from_this());
+  GatherBuffers gather = { &buffers };
+  boost::asio::async_write(m_socket, gather, m_strand.wrap(
+    [this, self](const boost::system::error_code& ec, std::size_t bytes) {
+      m_writeCb(ec, bytes);
+    }
+  ));
+}
+
+void UnixTransport::close()
+{
+  boost::system::error_code ec;
+  m_socket.shutdown(boost::asio::local::stream_protocol::socket::shutdown_both, ec);
+  // closing cancels outstanding operations
+  m_socket.close(ec);
+}
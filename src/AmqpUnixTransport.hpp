@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <boost/asio/local/stream_protocol.hpp>
+#include "AmqpTransport.hpp"
+
+namespace amqp {
+
+///
+/// Транспорт через сокет домена Unix.
+
+/// Используется, когда брокер работает на том же хосте: обмен через
+/// AF_UNIX обходится дешевле, чем через петлевой интерфейс TCP. Выбирается
+/// URL брокера со схемой amqp+unix, см. UnixSocketPath().
+///
+/// @author cycleg
+///
+class UnixTransport: public Transport
+{
+  public:
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] service Ссылка на экземпляр службы ввода/вывода.
+    /// @param [in] strand Strand, через который вызываются обработчики.
+    /// @param [in] path Путь к сокету брокера.
+    ///
+    UnixTransport(boost::asio::io_service& service,
+                  const boost::asio::io_service::strand& strand,
+                  const std::string& path);
+    ///
+    /// Деструктор.
+    ///
+    ~UnixTransport();
+
+    void connect(ConnectCallback callback) override;
+    void read(const boost::asio::mutable_buffers_1& buffer) override;
+    void write(const std::vector<boost::asio::const_buffer>& buffers) override;
+    void close() override;
+
+  private:
+    boost::asio::local::stream_protocol::socket m_socket; ///< Сокет
+                                                          ///< соединения с
+                                                          ///< брокером.
+    std::string m_path; ///< Путь к сокету брокера.
+};
+
+} // namespace amqp
@@ -0,0 +1,115 @@
+#include <cstring>
+#include "AmqpWireCapture.hpp"
+
+using namespace amqp;
+
+namespace {
+
+const char Signature[8] = { 'A', 'M', 'Q', 'P', 'C', 'A', 'P', 1 };
+
+void PutU32(char* out, uint32_t value)
+{
+  for (int i = 3; i >= 0; --i, value >>= 8) out[i] = char(value & 0xFF);
+}
+
+uint32_t GetU32(const char* in)
+{
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(in);
+  return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) |
+         (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+} // namespace
+
+WireCapture::WireCapture(const std::string& path):
+  m_file(path, std::ios::binary | std::ios::trunc),
+  m_connections(0)
+{
+  m_file.write(Signature, sizeof(Signature));
+}
+
+WireCapture::~WireCapture()
+{
+}
+
+bool WireCapture::good()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_file.good();
+}
+
+uint32_t WireCapture::begin()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  uint32_t connection = m_connections++;
+  char header[8];
+  PutU32(header, connection);
+  PutU32(header + 4, 0);
+  m_file.write(header, sizeof(header));
+  return connection;
+}
+
+void WireCapture::record(uint32_t connection, const char* data,
+                         std::size_t size)
+{
+  if (!size) return; // an empty record opens a connection
+  std::lock_guard<std::mutex> lock(m_mutex);
+  char header[8];
+  PutU32(header, connection);
+  PutU32(header + 4, size);
+  m_file.write(header, sizeof(header));
+  m_file.write(data, size);
+}
+
+void WireCapture::flush()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_file.flush();
+}
+
+bool WireCapture::Load(const std::string& path,
+                       std::vector<Chunks>& connections, std::string& error)
+{
+  connections.clear();
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    error = "can't open " + path;
+    return false;
+  }
+  char header[8];
+  if (!file.read(header, sizeof(header)) ||
+      std::memcmp(header, Signature, sizeof(Signature)))
+  {
+    error = path + " is not a wire capture";
+    return false;
+  }
+  while (file.read(header, sizeof(header)))
+  {
+    uint32_t connection = GetU32(header), size = GetU32(header + 4);
+    if (!size)
+    {
+      if (connection >= connections.size()) connections.resize(connection + 1);
+      continue;
+    }
+    if (connection >= connections.size())
+    {
+      error = "record of an unregistered connection";
+      return false;
+    }
+    std::string chunk(size, '\0');
+    if (!file.read(&chunk[0], size))
+    {
+      // the capturing process may have been killed during a write
+      error = "truncated record";
+      return false;
+    }
+    connections[connection].push_back(std::move(chunk));
+  }
+  if (file.gcount())
+  {
+    error = "truncated record";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace amqp {
+
+///
+/// Запись принятых от брокера байтов в файл.
+
+/// Экземпляр задается в ConnectionOptions::wireCapture. Каждый
+/// amqp::ConnectionHandler, получивший параметры, регистрирует в нем свое
+/// соединение (begin()) и записывает каждую порцию данных, принятую
+/// ConnectionHandler::onRead(), до ее разбора (record()). Границы порций
+/// сохраняются, поэтому запись можно воспроизвести с той же нарезкой, что и
+/// в реальном обмене, например, программой amqp-replay.
+///
+/// Формат файла: сигнатура "AMQPCAP" и байт версии (1), затем записи из
+/// номера соединения (4 байта), размера порции (4 байта, сетевой порядок) и
+/// самой порции. Запись нулевого размера открывает соединение. Записи
+/// разных соединений могут чередоваться.
+///
+/// Запись синхронная, это средство диагностики, а не рабочего режима.
+/// Методы потокобезопасны: экземпляр можно разделить между коннекторами.
+///
+/// @author cycleg
+///
+class WireCapture
+{
+  public:
+    ///
+    /// Порции данных одного соединения в порядке приема.
+    ///
+    typedef std::vector<std::string> Chunks;
+
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] path Файл записи. Существующий файл перезаписывается.
+    ///
+    explicit WireCapture(const std::string& path);
+    ///
+    /// Деструктор.
+    ///
+    ~WireCapture();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    WireCapture(const WireCapture&) = delete;
+
+    ///
+    /// Файл открыт и ошибок записи не было.
+    ///
+    /// @return Исправен или нет.
+    ///
+    bool good();
+    ///
+    /// Зарегистрировать новое соединение.
+    ///
+    /// @return Номер соединения для record().
+    ///
+    uint32_t begin();
+    ///
+    /// Записать принятую порцию данных.
+    ///
+    /// @param [in] connection Номер соединения.
+    /// @param [in] data Данные.
+    /// @param [in] size Размер данных.
+    ///
+    void record(uint32_t connection, const char* data, std::size_t size);
+    ///
+    /// Сбросить записанное в файл.
+    ///
+    void flush();
+
+    ///
+    /// Прочитать файл записи.
+    ///
+    /// @param [in] path Файл записи.
+    /// @param [out] connections Порции данных каждого соединения в порядке
+    ///                          регистрации соединений.
+    /// @param [out] error Описание ошибки.
+    /// @return Файл прочитан целиком или нет.
+    ///
+    /// Если файл оборван (процесс завершился во время записи), в connections
+    /// остаются порции, прочитанные до обрыва.
+    ///
+    static bool Load(const std::string& path, std::vector<Chunks>& connections,
+                     std::string& error);
+
+  private:
+    std::mutex m_mutex; ///< Защита файла.
+    std::ofstream m_file; ///< Файл записи.
+    uint32_t m_connections; ///< Число зарегистрированных соединений.
+};
+
+} // namespace amqp
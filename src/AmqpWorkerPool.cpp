@@ -0,0 +1,111 @@
+#include "AmqpWorkerPool.hpp"
+
+using namespace amqp;
+
+WorkerPool::WorkerPool(std::size_t threads, Handler handler, KeyExtractor key):
+  m_handler(handler),
+  m_partitions(std::make_shared<Partitions>())
+{
+  m_partitions->key = key;
+  if (!threads) threads = 1;
+  for (std::size_t i = 0; i < threads; ++i)
+    m_partitions->workers.emplace_back(new Worker);
+  for (auto& worker: m_partitions->workers)
+  {
+    Worker* w = worker.get();
+    w->thread = std::thread([this, w]() { Run(*w); });
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  for (auto& worker: m_partitions->workers)
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->stopping = true;
+    worker->wakeup.notify_one();
+  }
+  for (auto& worker: m_partitions->workers) worker->thread.join();
+  // the broker would hold unfinished deliveries until the channel closes
+  for (auto& worker: m_partitions->workers)
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (auto& task: worker->tasks) task.handle.reject(true);
+    worker->tasks.clear();
+  }
+}
+
+void WorkerPool::attach(const std::shared_ptr<Transceiver>& transceiver)
+{
+  Transceiver* trn = transceiver.get();
+  std::weak_ptr<Partitions> weak(m_partitions);
+  transceiver->onMessage([weak, trn](AMQP::Channel* channel,
+                                     const AMQP::Message& message,
+                                     uint64_t deliveryTag, bool redelivered) {
+    auto partitions = weak.lock();
+    if (!partitions)
+    {
+      // the pool is gone, the message goes back to the queue
+      trn->ackHandle(deliveryTag, channel).reject(true);
+      return;
+    }
+    std::size_t partition = std::hash<std::string>()(
+      partitions->key ? partitions->key(message) : message.routingkey()
+    ) % partitions->workers.size();
+    // AMQP-CPP owns the message only until the handler returns
+    Task task{
+      Delivery{
+        message.exchange(), message.routingkey(),
+        std::string(message.body(), message.bodySize()), message,
+        deliveryTag, redelivered
+      },
+      trn->ackHandle(deliveryTag, channel)
+    };
+    Worker& worker = *partitions->workers[partition];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    // the pool is being destroyed, no worker takes the task
+    if (worker.stopping) task.handle.reject(true);
+      else
+      {
+        worker.tasks.push_back(std::move(task));
+        worker.wakeup.notify_one();
+      }
+  });
+}
+
+void WorkerPool::Run(Worker& worker)
+{
+  std::unique_lock<std::mutex> lock(worker.mutex);
+  while (true)
+  {
+    worker.wakeup.wait(lock, [&worker]() {
+      return worker.stopping || !worker.tasks.empty();
+    });
+    if (worker.stopping) break;
+    Task task(std::move(worker.tasks.front()));
+    worker.tasks.pop_front();
+    lock.unlock();
+    Outcome outcome = eRequeue;
+    try
+    {
+      outcome = m_handler(task.delivery);
+    }
+    catch (...)
+    {
+      // the message goes back to the queue, the worker survives
+    }
+    switch (outcome)
+    {
+      case eAck:
+        task.handle.ack();
+        break;
+      case eReject:
+        task.handle.reject(false);
+        break;
+      case eRequeue:
+        task.handle.reject(true);
+        break;
+    }
+    lock.lock();
+  }
+}
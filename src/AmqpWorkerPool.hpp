@@ -0,0 +1,170 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <amqpcpp.h>
+#include "AmqpAckHandle.hpp"
+#include "AmqpTransceiver.hpp"
+
+namespace amqp {
+
+///
+/// Пул рабочих потоков для обработки входящих сообщений.
+
+/// По умолчанию входящие сообщения обрабатываются прямо в обработчике
+/// приема, в потоке ввода/вывода, и медленный обработчик задерживает все
+/// соединение. Пул, подключенный к приемопередатчику методом attach(),
+/// забирает сообщения у приемопередатчика и раздает их рабочим потокам.
+///
+/// Сообщения разбиваются на разделы по ключу, который извлекает функция
+/// KeyExtractor (по умолчанию -- маршрут сообщения). Все сообщения раздела
+/// обрабатывает один поток в порядке поступления, поэтому порядок сообщений
+/// с одинаковым ключом сохраняется. Пулу передается копия сообщения
+/// (Delivery): данные AMQP-CPP действительны только в обработчике приема.
+///
+/// Результат обработки (Outcome) завершает отложенное подтверждение
+/// сообщения (AckHandle): результаты, накопившиеся в очереди
+/// приемопередатчика, разбираются в strand коннектора одной порцией, и с
+/// включенным Transceiver::coalesceAcks() уходят брокеру кадрами с флагом
+/// "multiple". Результаты, полученные после перезапуска канала
+/// приемопередатчика, отбрасываются: брокер сам вернет такие сообщения в
+/// очередь.
+///
+/// Очереди потоков не ограничены, число сообщений в них ограничивает
+/// prefetch приемопередатчика (Transceiver::prefetch()).
+///
+/// При уничтожении пула потоки завершаются после текущего сообщения,
+/// необработанные сообщения отвергаются с возвратом в очередь. Сообщения,
+/// поступившие приемопередатчику после уничтожения пула, также
+/// возвращаются в очередь: приемопередатчик может пережить пул.
+///
+/// @author cycleg
+///
+class WorkerPool
+{
+  public:
+    ///
+    /// Входящее сообщение, переданное рабочему потоку.
+    ///
+    struct Delivery
+    {
+      std::string exchange; ///< Точка обмена.
+      std::string routingKey; ///< Маршрут.
+      std::string body; ///< Тело сообщения.
+      AMQP::MetaData properties; ///< Свойства сообщения.
+      uint64_t deliveryTag; ///< Метка сообщения.
+      bool redelivered; ///< Сообщение доставляется повторно.
+    };
+
+    ///
+    /// Результат обработки сообщения.
+    ///
+    enum Outcome
+    {
+      eAck, ///< Подтвердить.
+      eReject, ///< Отвергнуть.
+      eRequeue ///< Отвергнуть и вернуть в очередь.
+    };
+
+    ///
+    /// Указатель на функцию обработки сообщения в рабочем потоке.
+    ///
+    typedef std::function<Outcome(const Delivery& delivery)> Handler;
+
+    ///
+    /// Указатель на функцию, извлекающую из сообщения ключ раздела.
+    ///
+    typedef std::function<std::string(const AMQP::Message& message)>
+      KeyExtractor;
+
+    ///
+    /// Конструктор.
+    ///
+    /// @param [in] threads Число рабочих потоков (разделов), не меньше 1.
+    /// @param [in] handler Обработчик сообщений.
+    /// @param [in] key Извлечение ключа раздела (необязательный). По
+    ///                 умолчанию -- маршрут сообщения.
+    ///
+    WorkerPool(std::size_t threads, Handler handler,
+               KeyExtractor key = nullptr);
+    ///
+    /// Деструктор.
+    ///
+    ~WorkerPool();
+
+    ///
+    /// Копирующий конструктор запрещен.
+    ///
+    WorkerPool(const WorkerPool&) = delete;
+
+    ///
+    /// Подключить пул к приемопередатчику.
+    ///
+    /// @param [in] transceiver Приемопередатчик.
+    ///
+    /// Заменяет обработчик входящих сообщений приемопередатчика
+    /// (Transceiver::onMessage()). Вызывается до запуска коннектора или в
+    /// его strand. Пул может обслуживать несколько приемопередатчиков.
+    ///
+    void attach(const std::shared_ptr<Transceiver>& transceiver);
+
+    ///
+    /// Число рабочих потоков.
+    ///
+    /// @return Число потоков.
+    ///
+    inline std::size_t threads() const { return m_partitions->workers.size(); }
+
+  private:
+    ///
+    /// Задача рабочего потока.
+    ///
+    struct Task
+    {
+      Delivery delivery; ///< Сообщение.
+      AckHandle handle; ///< Подтверждение сообщения.
+    };
+
+    ///
+    /// Рабочий поток с очередью задач.
+    ///
+    struct Worker
+    {
+      std::mutex mutex; ///< Защита tasks.
+      std::condition_variable wakeup; ///< Появление задачи или остановка.
+      std::deque<Task> tasks; ///< Очередь задач.
+      bool stopping = false; ///< Поток завершается.
+      std::thread thread; ///< Поток.
+    };
+
+    ///
+    /// Разделы пула.
+    ///
+    /// Принадлежат пулу, обработчики приемопередатчиков ссылаются на них
+    /// слабыми указателями.
+    ///
+    struct Partitions
+    {
+      KeyExtractor key; ///< Извлечение ключа раздела.
+      std::vector< std::unique_ptr<Worker> > workers; ///< Рабочие потоки.
+    };
+
+    ///
+    /// Цикл рабочего потока.
+    ///
+    /// @param [in] worker Рабочий поток.
+    ///
+    void Run(Worker& worker);
+
+    Handler m_handler; ///< Обработчик сообщений.
+    std::shared_ptr<Partitions> m_partitions; ///< Разделы пула.
+};
+
+} // namespace amqp
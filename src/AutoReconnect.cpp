@@ -10,7 +10,7 @@ using namespace amqp;
 AutoReconnect::AutoReconnect(const std::shared_ptr< amqp::Connector<> >& connector):
   m_connector(connector),
   m_started(false),
-  m_needStop(false),
+  m_waiting(false),
   m_rerun(false),
   m_backupExitCallback(nullptr),
   m_startedCallback(nullptr),
@@ -31,30 +31,36 @@ std::shared_ptr<AutoReconnect> AutoReconnect::Factory(
 
 void AutoReconnect::start(amqp::Connector<>::StartedCallback callback)
 {
-  if (m_started) return;
-  m_needStop = false;
-  m_rerun = false;
-  m_backupExitCallback = m_connector->getOnExit();
-  m_startedCallback = callback;
-  m_connector->onExit(std::bind(&AutoReconnect::restart, this, std::placeholders::_1));
-  m_connector->async_start([this]() {
-    this->started();
+  m_connector->strand().dispatch([this, callback]() {
+    if (m_started) return;
+    m_waiting = false;
+    m_rerun = false;
+    m_backupExitCallback = m_connector->getOnExit();
+    m_startedCallback = callback;
+    m_connector->onExit(std::bind(&AutoReconnect::restart, this, std::placeholders::_1));
+    m_connector->async_start([this]() {
+      this->started();
+    });
+    m_started = true;
   });
-  m_started = true;
 }
 
 void AutoReconnect::stop()
 {
-  if (!m_started) return;
-  m_timer.cancel();
-  if (m_connector->ready())
-    m_connector->stop();
-    else
+  m_connector->strand().dispatch([this]() {
+    if (!m_started) return;
+    m_started = false;
+    if (m_waiting)
     {
-      // коннектор в процессе подключения
-      m_needStop = true;
+      // коннектор простаивает между попытками, прерывать нечего
+      m_waiting = false;
+      m_timer.cancel();
+      restart(amqp::Connector<>::eNormal);
+      return;
     }
-  m_started = false;
+    // подключение, если оно еще идет, прерывается
+    m_connector->stop();
+  });
 }
 
 void AutoReconnect::started()
@@ -62,12 +68,6 @@ void AutoReconnect::started()
 #ifndef NDEBUG
   std::clog << m_connector->url() << " connection established" << std::endl;
 #endif
-  if (m_needStop)
-  {
-    m_needStop = false;
-    m_connector->stop();
-    return;
-  }
   // вызывается ровно один раз: при первом установлении соединения
   if (m_startedCallback) m_startedCallback();
   m_startedCallback = nullptr;
@@ -103,13 +103,19 @@ void AutoReconnect::restart(amqp::Connector<>::ExitCode code)
                     << std::endl;
 #endif
           m_rerun = true;
+          m_waiting = true;
+          // broker addresses are refreshed while waiting
+          m_connector->resolve();
           m_timer.expires_from_now(std::chrono::seconds(1));
-          m_timer.async_wait([this](const boost::system::error_code& error) {
-            if (error == boost::asio::error::operation_aborted) return;
-            m_connector->async_start([this]() {
-              started();
-            });
-          });
+          m_timer.async_wait(m_connector->strand().wrap(
+            [this](const boost::system::error_code& error) {
+              if (error == boost::asio::error::operation_aborted) return;
+              m_waiting = false;
+              m_connector->async_start([this]() {
+                started();
+              });
+            }
+          ));
           break;
         case amqp::Connector<>::eAmqpError:
 #ifndef NDEBUG
@@ -117,14 +123,20 @@ void AutoReconnect::restart(amqp::Connector<>::ExitCode code)
                     << std::endl;
 #endif
           m_rerun = true;
+          m_waiting = true;
+          // broker addresses are refreshed while waiting
+          m_connector->resolve();
           m_timer.expires_from_now(std::chrono::seconds(1));
-          m_timer.async_wait([this](const boost::system::error_code& error) {
-            // timer cancelled
-            if (error == boost::asio::error::operation_aborted) return;
-            m_connector->async_start([this]() {
-              started();
-            });
-          });
+          m_timer.async_wait(m_connector->strand().wrap(
+            [this](const boost::system::error_code& error) {
+              // timer cancelled
+              if (error == boost::asio::error::operation_aborted) return;
+              m_waiting = false;
+              m_connector->async_start([this]() {
+                started();
+              });
+            }
+          ));
           break;
         default:
           break;
@@ -23,7 +23,8 @@ namespace amqp {
 ///
 /// После вызова AutoReconnect::start(), попытки установки (восстановления)
 /// соединения будут предприниматься с паузой в 1 секунду до тех пор, пока не
-/// будет вызван AutoReconnect::stop().
+/// будет вызван AutoReconnect::stop(). Во время паузы адреса брокера
+/// обновляются в кэше разрешения имен (см. amqp::Connector::resolve()).
 ///
 /// Пара методов start() и stop() может вызываться неоднократно.
 ///
@@ -68,6 +69,9 @@ class AutoReconnect
     ///
     /// Завершить работу с брокером.
     ///
+    /// Работа завершается асинхронно, метод не ждет отключения. Если
+    /// подключение к брокеру еще идет, оно прерывается.
+    ///
     /// Если метод вызван повторно или до вызова start(), то не делает ничего.
     ///
     void stop();
@@ -102,8 +106,8 @@ class AutoReconnect
     std::shared_ptr< amqp::Connector<> > m_connector; ///< Обслуживаемый
                                                       ///< коннектор.
     bool m_started, ///< Флаг, что был вызван start(). 
-         m_needStop, ///< Флаг, что соединение нужно разорвать после
-                     ///< успешного установления (был вызван stop()).
+         m_waiting, ///< Флаг, что выдерживается пауза перед следующей
+                    ///< попыткой соединиться.
          m_rerun; ///< Флаг, что после успешного установления соединения
                   ///< amqp::Connector нужно запустить.
     amqp::Connector<>::ExitCallback m_backupExitCallback; ///< Указатель на
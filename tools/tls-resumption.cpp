@@ -0,0 +1,281 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include "../src/AmqpConnector.hpp"
+#include "../src/AmqpTlsContext.hpp"
+#include "../benchmarks/FakeBroker.hpp"
+
+/*
+Connect to the in-process fake broker over amqps:// several times with one
+connector and check that the TLS session of the first connection is resumed
+by the next ones.
+
+The fake broker speaks plain AMQP on a Unix socket, a TLS front terminates
+the connections with a self-signed certificate generated for localhost, the
+connector trusts exactly this certificate.
+*/
+
+const char* amqpUser = "guest:guest";
+const unsigned Rounds = 3;
+const std::chrono::seconds Deadline(30);
+
+namespace {
+
+///
+/// Ключ и самоподписанный сертификат для localhost.
+///
+struct Identity
+{
+  EVP_PKEY* key = nullptr;
+  X509* certificate = nullptr;
+
+  ~Identity()
+  {
+    if (certificate) X509_free(certificate);
+    if (key) EVP_PKEY_free(key);
+  }
+};
+
+bool MakeIdentity(Identity& identity)
+{
+  EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  bool ok = pctx && (EVP_PKEY_keygen_init(pctx) > 0) &&
+    (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) > 0) &&
+    (EVP_PKEY_keygen(pctx, &identity.key) > 0);
+  if (pctx) EVP_PKEY_CTX_free(pctx);
+  if (!ok) return false;
+  X509* x = identity.certificate = X509_new();
+  X509_set_version(x, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x), -60);
+  X509_gmtime_adj(X509_getm_notAfter(x), 24 * 3600);
+  X509_set_pubkey(x, identity.key);
+  X509_NAME* name = X509_get_subject_name(x);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+    reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(x, name);
+  const std::pair<int, const char*> extensions[] = {
+    { NID_basic_constraints, "critical,CA:TRUE" },
+    { NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1,IP:::1" }
+  };
+  for (auto& e: extensions)
+  {
+    X509_EXTENSION* extension = X509V3_EXT_conf_nid(nullptr, nullptr, e.first,
+                                                    const_cast<char*>(e.second));
+    if (!extension) return false;
+    X509_add_ext(x, extension, -1);
+    X509_EXTENSION_free(extension);
+  }
+  return X509_sign(x, identity.key, EVP_sha256()) > 0;
+}
+
+bool WriteCertificate(const Identity& identity, const std::string& path)
+{
+  BIO* bio = BIO_new_file(path.c_str(), "w");
+  if (!bio) return false;
+  bool ok = PEM_write_bio_X509(bio, identity.certificate) > 0;
+  BIO_free(bio);
+  return ok;
+}
+
+///
+/// Терминатор TLS перед имитатором брокера.
+///
+/// Принимает соединения TCP на петлевом интерфейсе, выполняет рукопожатие
+/// TLS и пересылает данные в обе стороны между потоком TLS и соединением с
+/// сокетом брокера. Сессии TLS возобновляются средствами OpenSSL (билеты
+/// сессий, кэш сервера).
+///
+class TlsFront
+{
+  public:
+    TlsFront(boost::asio::io_service& service, const Identity& identity,
+             const std::string& brokerPath):
+      m_service(service),
+      m_context(boost::asio::ssl::context::sslv23_server),
+      m_acceptor(service, boost::asio::ip::tcp::endpoint(
+        boost::asio::ip::address_v4::loopback(), 0
+      )),
+      m_brokerPath(brokerPath),
+      m_handshakes(0)
+    {
+      SSL_CTX* ctx = m_context.native_handle();
+      SSL_CTX_use_certificate(ctx, identity.certificate);
+      SSL_CTX_use_PrivateKey(ctx, identity.key);
+      static const unsigned char sid[] = "amqpasio";
+      SSL_CTX_set_session_id_context(ctx, sid, sizeof(sid) - 1);
+      accept();
+    }
+
+    ~TlsFront()
+    {
+      boost::system::error_code ec;
+      m_acceptor.close(ec);
+    }
+
+    unsigned short port() const { return m_acceptor.local_endpoint().port(); }
+    unsigned handshakes() const { return m_handshakes; }
+
+  private:
+    ///
+    /// Пересылка одного соединения.
+    ///
+    struct Link: public std::enable_shared_from_this<Link>
+    {
+      boost::asio::ssl::stream<boost::asio::ip::tcp::socket> tls;
+      boost::asio::local::stream_protocol::socket broker;
+      char up[16384], down[16384];
+
+      Link(boost::asio::io_service& service, boost::asio::ssl::context& context):
+        tls(service, context), broker(service) {}
+
+      void close()
+      {
+        boost::system::error_code ec;
+        tls.lowest_layer().close(ec);
+        broker.close(ec);
+      }
+
+      void pumpUp()
+      {
+        auto self(shared_from_this());
+        tls.async_read_some(boost::asio::buffer(up),
+          [self](const boost::system::error_code& ec, std::size_t bytes) {
+            if (ec) return self->close();
+            boost::asio::async_write(self->broker,
+              boost::asio::buffer(self->up, bytes),
+              [self](const boost::system::error_code& ec, std::size_t) {
+                if (ec) return self->close();
+                self->pumpUp();
+              });
+          });
+      }
+
+      void pumpDown()
+      {
+        auto self(shared_from_this());
+        broker.async_read_some(boost::asio::buffer(down),
+          [self](const boost::system::error_code& ec, std::size_t bytes) {
+            if (ec) return self->close();
+            boost::asio::async_write(self->tls,
+              boost::asio::buffer(self->down, bytes),
+              [self](const boost::system::error_code& ec, std::size_t) {
+                if (ec) return self->close();
+                self->pumpDown();
+              });
+          });
+      }
+    };
+
+    void accept()
+    {
+      auto link = std::make_shared<Link>(m_service, m_context);
+      m_acceptor.async_accept(link->tls.lowest_layer(),
+        [this, link](const boost::system::error_code& ec) {
+          if (ec) return;
+          accept();
+          link->tls.async_handshake(boost::asio::ssl::stream_base::server,
+            [this, link](const boost::system::error_code& ec) {
+              if (ec) return link->close();
+              ++m_handshakes;
+              boost::system::error_code error;
+              link->broker.connect(
+                boost::asio::local::stream_protocol::endpoint(m_brokerPath),
+                error
+              );
+              if (error) return link->close();
+              link->pumpUp();
+              link->pumpDown();
+            });
+        });
+    }
+
+    boost::asio::io_service& m_service;
+    boost::asio::ssl::context m_context;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::string m_brokerPath;
+    unsigned m_handshakes;
+};
+
+template<class Predicate>
+bool RunUntil(boost::asio::io_service& service, Predicate done)
+{
+  while (!done())
+    if (!service.run_one())
+    {
+      service.reset();
+      return done();
+    }
+  return true;
+}
+
+} // namespace
+
+int main()
+{
+  std::string base = "/tmp/amqp-tls-" + std::to_string(::getpid()),
+              brokerPath = base + ".sock",
+              certPath = base + ".pem";
+  Identity identity;
+  if (!MakeIdentity(identity) || !WriteCertificate(identity, certPath))
+  {
+    std::cerr << "can't make a certificate" << std::endl;
+    return EXIT_FAILURE;
+  }
+  boost::asio::io_service service;
+  // the fake broker and the front keep the service busy, a stuck round
+  // stops it
+  boost::asio::steady_timer deadline(service);
+  deadline.expires_from_now(Deadline);
+  deadline.async_wait([&service](const boost::system::error_code& ec) {
+    if (!ec) service.stop();
+  });
+  amqp::bench::FakeBroker broker(service);
+  broker.listen(brokerPath);
+  TlsFront front(service, identity, brokerPath);
+  amqp::ConnectionOptions options;
+  options.heartbeat = 0;
+  options.tlsCaFile = certPath;
+  std::string url = std::string("amqps://") + amqpUser + "@localhost:" +
+                    std::to_string(front.port()) + "/";
+  bool ok = true;
+  std::size_t resumed = 0;
+  {
+    amqp::Connector<> connector(service, url, options);
+    for (unsigned round = 0; ok && (round < Rounds); ++round)
+    {
+      bool started = false, stopped = false;
+      connector.async_start([&started]() { started = true; });
+      ok = RunUntil(service, [&started]() { return started; }) &&
+           connector.ready();
+      connector.stop([&stopped]() { stopped = true; });
+      ok = RunUntil(service, [&stopped]() { return stopped; }) && ok;
+      std::cout << "round " << round << ": " << (ok ? "connected" : "failed")
+                << ", resumed " << connector.tls()->resumed() << std::endl;
+    }
+    resumed = connector.tls()->resumed();
+  }
+  std::remove(certPath.c_str());
+  if (!ok) return EXIT_FAILURE;
+  // the first handshake is full, the following ones may be resumed
+  if (resumed == 0)
+  {
+    std::cerr << "no TLS session was resumed in " << front.handshakes()
+              << " handshakes" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}